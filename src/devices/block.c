@@ -3,7 +3,20 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Most sectors that the dispatcher merges from separate requests
+   into one transfer, the size of its bounce page. */
+#define MERGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Ticks a request may wait in a queue before it is dispatched
+   ahead of the elevator order. */
+#define REQUEST_DEADLINE (TIMER_FREQ / 10)
 
 /* A block device. */
 struct block
@@ -19,6 +32,13 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, if enabled by block_enable_queue(). */
+    bool queued;                        /* Go through the queue? */
+    struct lock queue_lock;             /* Guards the members below. */
+    struct condition queue_nonempty;    /* Signaled when a request arrives. */
+    struct list queue;                  /* Pending requests, by sector. */
+    block_sector_t head_pos;            /* Sector after the last dispatched. */
   };
 
 /* List of all block devices. */
@@ -28,6 +48,10 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t, size_t cnt,
+                      void *buffer, bool write);
+static bool request_less (const struct list_elem *,
+                          const struct list_elem *, void *aux);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +144,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +155,293 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from BLOCK into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  If the
+   driver supports multi-sector transfers, the whole run costs one
+   request instead of CNT.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = buffer;
+  r.write = false;
+  r.complete = NULL;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT sectors starting at SECTOR to BLOCK from BUFFER, which
+   must contain CNT * BLOCK_SECTOR_SIZE bytes, as one request if the
+   driver supports it.  Returns after the block device has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  r.sector = sector;
+  r.cnt = cnt;
+  r.buffer = (void *) buffer;
+  r.write = true;
+  r.complete = NULL;
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Starts the transfer described by R on BLOCK and returns,
+   possibly before it completes.  R->cnt must be at least 1.  The
+   caller must eventually block_wait() for R, unless it set
+   R->complete, in which case it must not wait for R at all.
+   Devices without a queue or a submit operation carry out the
+   transfer before returning. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  ASSERT (r->cnt > 0);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+  sema_init (&r->done, 0);
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+
+  if (block->queued)
+    {
+      r->deadline = timer_ticks () + REQUEST_DEADLINE;
+      lock_acquire (&block->queue_lock);
+      list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+      cond_signal (&block->queue_nonempty, &block->queue_lock);
+      lock_release (&block->queue_lock);
+    }
+  else if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, r);
+  else
+    {
+      transfer (block, r->sector, r->cnt, r->buffer, r->write);
+      block_complete (r);
+    }
+}
+
+/* Waits for the transfer R, passed to block_submit(), to
+   complete.  May be called at most once per submission. */
+void
+block_wait (struct block_request *r)
+{
+  sema_down (&r->done);
+}
+
+/* Marks R as complete.  For use by drivers with a submit
+   operation, once a request they were given is done.  R must not
+   be touched afterward, because its waiter, or its completion
+   function, may free it.  The completion function runs last for
+   that reason, so nobody may wait for a request that has one. */
+void
+block_complete (struct block_request *r)
+{
+  void (*complete) (struct block_request *) = r->complete;
+
+  sema_up (&r->done);
+  if (complete != NULL)
+    complete (r);
+}
+
+/* Passes a transfer of CNT sectors starting at SECTOR between
+   BLOCK and BUFFER straight to the driver, as a single request if
+   it supports multi-sector transfers. */
+static void
+transfer (struct block *block, block_sector_t sector, size_t cnt,
+          void *buffer, bool write)
+{
+  const struct block_operations *ops = block->ops;
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write)
+    {
+      if (cnt > 1 && ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, cnt, p);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+    }
+  else
+    {
+      if (cnt > 1 && ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, cnt, p);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i, p + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Request queue.
+
+   A device with a queue is driven by its own dispatcher thread.
+   block_submit() adds a request, sorted by sector, and the
+   dispatcher carries it out later.  The dispatcher serves requests
+   in C-LOOK order: the lowest sector at or past the head position,
+   wrapping around to the lowest sector overall, so the disk sweeps
+   in one direction instead of seeking back and forth between
+   processes.  A request that has waited REQUEST_DEADLINE ticks is
+   served first regardless, so a stream of nearby requests cannot
+   starve a distant one.  Adjacent requests in the same direction
+   are merged into one transfer of up to MERGE_SECTORS sectors. */
+
+/* Returns true if request A's sector precedes B's. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* Returns the request in BLOCK's queue to serve next: the oldest
+   one if it is past its deadline, otherwise the next in C-LOOK
+   order.  Caller must hold BLOCK's queue_lock and the queue must
+   not be empty. */
+static struct block_request *
+next_request (struct block *block)
+{
+  struct block_request *oldest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (oldest == NULL || r->deadline < oldest->deadline)
+        oldest = r;
+    }
+  if (oldest->deadline <= timer_ticks ())
+    return oldest;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector >= block->head_pos)
+        return r;
+    }
+  return list_entry (list_front (&block->queue), struct block_request, elem);
+}
+
+/* Removes the next request from BLOCK's queue, along with any that
+   directly follow it on disk in the same direction, as long as
+   the run stays within MAX_SECTORS.  Stores them in BATCH and
+   returns how many there are.  Caller must hold BLOCK's
+   queue_lock and the queue must not be empty. */
+static size_t
+take_batch (struct block *block, struct block_request *batch[],
+            size_t max_sectors)
+{
+  struct block_request *r = next_request (block);
+  size_t n = 0, sectors = r->cnt;
+
+  for (;;)
+    {
+      struct list_elem *next = list_remove (&r->elem);
+      struct block_request *s;
+
+      batch[n++] = r;
+      block->head_pos = r->sector + r->cnt;
+      if (next == list_end (&block->queue))
+        break;
+      s = list_entry (next, struct block_request, elem);
+      if (s->sector != block->head_pos || s->write != r->write
+          || sectors + s->cnt > max_sectors)
+        break;
+      sectors += s->cnt;
+      r = s;
+    }
+  return n;
+}
+
+/* Dispatcher thread for the block device BLOCK_, which serves
+   requests from its queue one batch at a time. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+  struct block_request *batch[MERGE_SECTORS];
+  uint8_t *bounce = palloc_get_page (0);   /* Without it, no merging. */
+
+  for (;;)
+    {
+      size_t n, i;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      n = take_batch (block, batch, bounce != NULL ? MERGE_SECTORS : 0);
+      lock_release (&block->queue_lock);
+
+      if (n == 1)
+        transfer (block, batch[0]->sector, batch[0]->cnt,
+                  batch[0]->buffer, batch[0]->write);
+      else
+        {
+          bool write = batch[0]->write;
+          size_t sectors = 0;
+          uint8_t *p;
+
+          for (i = 0, p = bounce; i < n; p += batch[i++]->cnt * BLOCK_SECTOR_SIZE)
+            {
+              sectors += batch[i]->cnt;
+              if (write)
+                memcpy (p, batch[i]->buffer, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+            }
+          transfer (block, batch[0]->sector, sectors, bounce, write);
+          if (!write)
+            for (i = 0, p = bounce; i < n; p += batch[i++]->cnt * BLOCK_SECTOR_SIZE)
+              memcpy (batch[i]->buffer, p, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+        }
+
+      for (i = 0; i < n; i++)
+        block_complete (batch[i]);
+    }
+}
+
+/* Gives BLOCK a request queue served by its own dispatcher thread,
+   so that concurrent requests reach the driver sorted and merged
+   instead of in arrival order.  Meant for devices where seeks are
+   expensive, such as disks; devices layered on top of one, like
+   partitions, need not have a queue of their own. */
+void
+block_enable_queue (struct block *block)
+{
+  char name[sizeof block->name + 3];
+
+  ASSERT (!block->queued);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_nonempty);
+  list_init (&block->queue);
+  block->head_pos = 0;
+
+  /* The dispatcher mostly sleeps on the disk, so running it ahead
+     of CPU-bound threads keeps the disk busy at little cost. */
+  snprintf (name, sizeof name, "%s-io", block->name);
+  if (thread_create (name, PRI_MAX, dispatcher, block) != TID_ERROR)
+    block->queued = true;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -200,6 +505,7 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->queued = false;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,41 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous transfer.  The caller sets the first group of
+   members, passes the request to block_submit(), and may do other
+   work until block_wait().  The request, and its buffer, must stay
+   allocated until the transfer completes. */
+struct block_request
+  {
+    block_sector_t sector;      /* First sector, relative to the device. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /* Write BUFFER, as opposed to reading it? */
+
+    /* Optional: called once the transfer completes, in whatever
+       thread completes it, as the last use of the request, so it
+       may free it.  A request with a completion function must not
+       be passed to block_wait().  Should be quick, since it may
+       hold up a device's queue. */
+    void (*complete) (struct block_request *);
+    void *aux;                  /* For the COMPLETE function. */
+
+    /* Owned by the block layer while the request is in flight.
+       SECTOR may also be rewritten by layered devices. */
+    struct list_elem elem;      /* Element in a device's queue. */
+    int64_t deadline;           /* Dispatch by this tick. */
+    struct semaphore done;      /* Up'd when the transfer completes. */
+  };
+
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +99,26 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT contiguous sectors at once.  If null,
+       the block layer falls back to one read or write per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+
+    /* Optional: for a device that forwards requests to others,
+       start the transfer described by the request without waiting
+       for it, and call block_complete() once it is done.  If null,
+       submitted requests to a device without a queue complete
+       synchronously. */
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_enable_queue (struct block *);
+void block_complete (struct block_request *);
 
 #endif /* devices/block.h */
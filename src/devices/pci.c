@@ -0,0 +1,163 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   using configuration mechanism #1, which every PC chipset that
+   Bochs and QEMU emulate supports.  See [PCI] for details. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /* Selects a configuration register. */
+#define PCI_CONFIG_DATA 0xcfc   /* Reads or writes the selected register. */
+
+/* Selects register REG of function D for a following access to
+   PCI_CONFIG_DATA. */
+static void
+select_register (const struct pci_dev *d, int reg)
+{
+  ASSERT (reg >= 0 && reg < 256 && reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (0x80000000u | (d->bus << 16) | (d->dev << 11)
+                          | (d->func << 8) | reg));
+}
+
+/* Returns the 32-bit configuration register REG of function D.
+   REG must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *d, int reg)
+{
+  select_register (d, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the 32-bit configuration register REG of function D to
+   VALUE.  REG must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *d, int reg, uint32_t value)
+{
+  select_register (d, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Scans every bus for functions for which MATCH returns true,
+   given each function's ID and class registers, and stores the
+   location of the INDEX'th one (counting from 0) in *D.  Returns
+   true if there is one, false otherwise. */
+static bool
+find_function (bool (*match) (uint32_t id, uint32_t class, const void *aux),
+               const void *aux, int index, struct pci_dev *d)
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          uint32_t id;
+
+          d->bus = bus;
+          d->dev = dev;
+          d->func = func;
+          id = pci_read_config (d, PCI_REG_ID);
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No such function.  If function 0 is missing then
+                 the whole device is. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (match (id, pci_read_config (d, PCI_REG_CLASS), aux)
+              && index-- == 0)
+            return true;
+
+          /* Only multi-function devices have functions past 0. */
+          if (func == 0
+              && !(pci_read_config (d, PCI_REG_HEADER) & 0x00800000))
+            break;
+        }
+  return false;
+}
+
+/* find_function() matcher for the class and subclass in the
+   uint8_t[2] array AUX. */
+static bool
+match_class (uint32_t id UNUSED, uint32_t class, const void *aux)
+{
+  const uint8_t *want = aux;
+  return (class >> 24) == want[0] && ((class >> 16) & 0xff) == want[1];
+}
+
+/* Scans every bus for the first function whose class and
+   subclass are CLASS and SUBCLASS.  If one is found, stores its
+   location in *D and returns true; otherwise returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *d)
+{
+  uint8_t want[2] = {class, subclass};
+  return find_function (match_class, want, 0, d);
+}
+
+/* find_function() matcher for the vendor and device IDs packed
+   into the uint32_t at AUX. */
+static bool
+match_id (uint32_t id, uint32_t class UNUSED, const void *aux)
+{
+  return id == *(const uint32_t *) aux;
+}
+
+/* Scans every bus for functions with the given VENDOR and DEVICE
+   IDs.  If there are more than INDEX of them, stores the location
+   of the INDEX'th one (counting from 0) in *D and returns true;
+   otherwise returns false. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int index,
+                 struct pci_dev *d)
+{
+  uint32_t want = ((uint32_t) device << 16) | vendor;
+  return find_function (match_id, &want, index, d);
+}
+
+/* Returns the programming interface byte of function D, whose
+   meaning depends on its class. */
+uint8_t
+pci_prog_if (const struct pci_dev *d)
+{
+  return pci_read_config (d, PCI_REG_CLASS) >> 8;
+}
+
+/* Returns the legacy PIC interrupt line (0...15) that function D
+   is wired to, or 0xff if none. */
+uint8_t
+pci_irq (const struct pci_dev *d)
+{
+  return pci_read_config (d, PCI_REG_IRQ) & 0xff;
+}
+
+/* Returns the I/O port base that base address register BAR
+   (0...5) of function D decodes, or 0 if that BAR is unused or
+   maps memory instead of I/O ports. */
+uint16_t
+pci_io_bar (const struct pci_dev *d, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (d, PCI_REG_BAR0 + bar * 4);
+  if (!(value & 1))
+    return 0;
+  return value & 0xfffc;
+}
+
+/* Lets function D decode its I/O ports and act as a bus master,
+   as it must to perform DMA. */
+void
+pci_enable_bus_master (const struct pci_dev *d)
+{
+  uint32_t command = pci_read_config (d, PCI_REG_COMMAND);
+
+  /* Writing 1s to the status half would clear its error bits,
+     so write back only the command half. */
+  pci_write_config (d, PCI_REG_COMMAND,
+                    (command & 0xffff) | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+}
@@ -0,0 +1,43 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A PCI function, identified by its position on the bus. */
+struct pci_dev
+  {
+    uint8_t bus;                /* Bus number, 0...255. */
+    uint8_t dev;                /* Device (slot) number, 0...31. */
+    uint8_t func;               /* Function number, 0...7. */
+  };
+
+/* Configuration space registers common to all header types.
+   Each is the offset of a 32-bit register. */
+#define PCI_REG_ID 0x00         /* Device ID (31:16), vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04    /* Status (31:16), command (15:0). */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog IF, revision. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+#define PCI_REG_BAR0 0x10       /* First of six base address registers. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line in bits 7:0. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001           /* Respond to I/O space accesses. */
+#define PCI_CMD_MEMORY 0x0002       /* Respond to memory space accesses. */
+#define PCI_CMD_BUS_MASTER 0x0004   /* May initiate DMA. */
+
+/* Device classes and subclasses that we look for. */
+#define PCI_CLASS_STORAGE 0x01      /* Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01       /* IDE controller. */
+
+uint32_t pci_read_config (const struct pci_dev *, int reg);
+void pci_write_config (const struct pci_dev *, int reg, uint32_t);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+bool pci_find_device (uint16_t vendor, uint16_t device, int index,
+                      struct pci_dev *);
+uint8_t pci_prog_if (const struct pci_dev *);
+uint8_t pci_irq (const struct pci_dev *);
+uint16_t pci_io_bar (const struct pci_dev *, int bar);
+void pci_enable_bus_master (const struct pci_dev *);
+
+#endif /* devices/pci.h */
@@ -0,0 +1,215 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+/* A striped ("RAID-0") block device, which spreads its sectors
+   over several member devices in chunks of STRIPE_CHUNK sectors,
+   round-robin.  A transfer that spans chunks on different members
+   is split and submitted to all of them at once, so members on
+   different IDE channels, each with its own request queue, work in
+   parallel.  There is no redundancy: losing a member loses the
+   whole device. */
+
+/* Sectors per chunk, one page, which is also the most the block
+   layer merges into one transfer. */
+#define STRIPE_CHUNK 8
+
+/* Most member devices. */
+#define STRIPE_MAX 4
+
+/* A striped device. */
+struct stripe
+  {
+    struct block *members[STRIPE_MAX];  /* Member devices. */
+    size_t member_cnt;                  /* Number of members. */
+  };
+
+/* A request split across members. */
+struct stripe_io
+  {
+    struct block_request *parent;       /* Request being carried out. */
+    size_t pending;                     /* Pieces not yet complete. */
+    struct block_request pieces[];      /* One per chunk touched. */
+  };
+
+static struct block_operations stripe_operations;
+
+/* Sets up a striped device named STRIPE_NAME over the block
+   devices named in BDEV_NAMES, which are separated by commas.
+   Every member contributes as many whole chunks as the smallest
+   one has.  Panics if a name is unknown or there are too few or
+   too many. */
+void
+stripe_init (char *bdev_names)
+{
+  struct stripe *s;
+  block_sector_t member_size = 0;
+  char *name, *save_ptr;
+  char extra_info[128];
+  size_t i;
+
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    PANIC ("Failed to allocate memory for stripe descriptor");
+  s->member_cnt = 0;
+
+  for (name = strtok_r (bdev_names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *member = block_get_by_name (name);
+      block_sector_t size;
+
+      if (member == NULL)
+        PANIC ("%s: no such block device \"%s\"", STRIPE_NAME, name);
+      if (s->member_cnt >= STRIPE_MAX)
+        PANIC ("%s: more than %d members", STRIPE_NAME, STRIPE_MAX);
+      s->members[s->member_cnt++] = member;
+
+      size = block_size (member) / STRIPE_CHUNK * STRIPE_CHUNK;
+      if (s->member_cnt == 1 || size < member_size)
+        member_size = size;
+    }
+  if (s->member_cnt < 2)
+    PANIC ("%s: need at least 2 members", STRIPE_NAME);
+
+  snprintf (extra_info, sizeof extra_info, "striped over");
+  for (i = 0; i < s->member_cnt; i++)
+    snprintf (extra_info + strlen (extra_info),
+              sizeof extra_info - strlen (extra_info),
+              " %s", block_name (s->members[i]));
+  block_register (STRIPE_NAME, BLOCK_FILESYS, extra_info,
+                  member_size * s->member_cnt, &stripe_operations, s);
+}
+
+/* Maps SECTOR of striped device S to a member, which is returned,
+   and the sector within it, which is stored in *MEMBER_SECTOR. */
+static struct block *
+map_sector (const struct stripe *s, block_sector_t sector,
+            block_sector_t *member_sector)
+{
+  block_sector_t chunk = sector / STRIPE_CHUNK;
+
+  *member_sector = chunk / s->member_cnt * STRIPE_CHUNK + sector % STRIPE_CHUNK;
+  return s->members[chunk % s->member_cnt];
+}
+
+/* Reads sector SECTOR from striped device S into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  block_sector_t member_sector;
+  struct block *member = map_sector (s_, sector, &member_sector);
+
+  block_read (member, member_sector, buffer);
+}
+
+/* Writes sector SECTOR to striped device S from BUFFER. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  block_sector_t member_sector;
+  struct block *member = map_sector (s_, sector, &member_sector);
+
+  block_write (member, member_sector, buffer);
+}
+
+/* Completion function for one piece of a split request.  Completes
+   the original request once every piece has completed.  The block
+   layer is done with PIECE by the time this runs, so the last
+   piece may free IO, which holds every piece. */
+static void
+piece_complete (struct block_request *piece)
+{
+  struct stripe_io *io = piece->aux;
+  enum intr_level old_level;
+  bool last;
+
+  /* Pieces on different members complete in different threads. */
+  old_level = intr_disable ();
+  last = --io->pending == 0;
+  intr_set_level (old_level);
+
+  if (last)
+    {
+      block_complete (io->parent);
+      free (io);
+    }
+}
+
+/* Starts request R on striped device S by submitting one piece per
+   chunk it touches to the member holding that chunk. */
+static void
+stripe_submit (void *s_, struct block_request *r)
+{
+  struct stripe *s = s_;
+  struct stripe_io *io;
+  size_t piece_cnt, i;
+  block_sector_t sector;
+  uint8_t *p;
+
+  piece_cnt = ((r->sector + r->cnt - 1) / STRIPE_CHUNK
+               - r->sector / STRIPE_CHUNK + 1);
+  io = malloc (sizeof *io + piece_cnt * sizeof *io->pieces);
+  if (io == NULL)
+    {
+      /* Fall back to one chunk at a time. */
+      for (sector = r->sector, p = r->buffer; sector < r->sector + r->cnt; )
+        {
+          size_t cnt = STRIPE_CHUNK - sector % STRIPE_CHUNK;
+          block_sector_t member_sector;
+          struct block *member = map_sector (s, sector, &member_sector);
+
+          if (cnt > r->sector + r->cnt - sector)
+            cnt = r->sector + r->cnt - sector;
+          if (r->write)
+            block_write_multiple (member, member_sector, cnt, p);
+          else
+            block_read_multiple (member, member_sector, cnt, p);
+          sector += cnt;
+          p += cnt * BLOCK_SECTOR_SIZE;
+        }
+      block_complete (r);
+      return;
+    }
+
+  /* Fill in every piece before submitting any, since the last one
+     to complete frees IO. */
+  io->parent = r;
+  io->pending = piece_cnt;
+  for (i = 0, sector = r->sector, p = r->buffer; i < piece_cnt; i++)
+    {
+      struct block_request *piece = &io->pieces[i];
+      size_t cnt = STRIPE_CHUNK - sector % STRIPE_CHUNK;
+
+      if (cnt > r->sector + r->cnt - sector)
+        cnt = r->sector + r->cnt - sector;
+      piece->cnt = cnt;
+      piece->buffer = p;
+      piece->write = r->write;
+      piece->complete = piece_complete;
+      piece->aux = io;
+      sector += cnt;
+      p += cnt * BLOCK_SECTOR_SIZE;
+    }
+  for (i = 0, sector = r->sector; i < piece_cnt; i++)
+    {
+      struct block_request *piece = &io->pieces[i];
+      struct block *member = map_sector (s, sector, &piece->sector);
+
+      sector += piece->cnt;
+      block_submit (member, piece);
+    }
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    NULL,
+    NULL,
+    stripe_submit
+  };
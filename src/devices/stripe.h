@@ -0,0 +1,9 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+/* Name of the striped block device created by stripe_init(). */
+#define STRIPE_NAME "md0"
+
+void stripe_init (char *bdev_names);
+
+#endif /* devices/stripe.h */
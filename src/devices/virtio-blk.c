@@ -0,0 +1,390 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices, as
+   emulated by QEMU ("-drive if=virtio"), using the legacy PCI
+   interface of [VIRTIO] 0.9.5.  Each request is a chain of three
+   descriptors (header, data, status) in a single virtqueue, so
+   many requests can be in flight at once; the device interrupts as
+   they complete and a per-disk thread finishes them off. */
+
+/* PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/* Legacy virtio I/O registers, relative to BAR 0. */
+#define reg_device_features(D) ((D)->io_base + 0x00) /* 32 bits. */
+#define reg_guest_features(D) ((D)->io_base + 0x04)  /* 32 bits. */
+#define reg_queue_pfn(D) ((D)->io_base + 0x08)       /* 32 bits. */
+#define reg_queue_size(D) ((D)->io_base + 0x0c)      /* 16 bits. */
+#define reg_queue_select(D) ((D)->io_base + 0x0e)    /* 16 bits. */
+#define reg_queue_notify(D) ((D)->io_base + 0x10)    /* 16 bits. */
+#define reg_status(D) ((D)->io_base + 0x12)          /* 8 bits. */
+#define reg_isr(D) ((D)->io_base + 0x13)             /* 8 bits. */
+#define reg_capacity(D) ((D)->io_base + 0x14)        /* 64 bits. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /* Guest noticed the device. */
+#define STATUS_DRIVER 0x02      /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04   /* Driver is ready. */
+#define STATUS_FAILED 0x80      /* Driver gave up. */
+
+/* Virtqueue descriptor flags. */
+#define DESC_NEXT 0x01          /* Chain continues at NEXT. */
+#define DESC_WRITE 0x02         /* Device writes this buffer. */
+
+/* Alignment of the used ring in a legacy virtqueue. */
+#define VRING_ALIGN 4096
+
+/* Block request types and status values. */
+#define BLK_T_IN 0              /* Read. */
+#define BLK_T_OUT 1             /* Write. */
+#define BLK_S_OK 0              /* Success. */
+
+/* Most disks and most requests in flight per disk. */
+#define DISK_CNT 4
+#define SLOT_CNT 64
+
+/* A virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address. */
+    uint32_t len;               /* Length in bytes. */
+    uint16_t flags;             /* DESC_* flags. */
+    uint16_t next;              /* Next descriptor, if DESC_NEXT. */
+  };
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the driver puts the next entry. */
+    uint16_t ring[];
+  };
+
+/* A chain the device has finished with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head descriptor of the chain. */
+    uint32_t len;               /* Bytes written. */
+  };
+
+/* Ring of descriptor chains returned by the device. */
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where the device puts the next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header of a block request. */
+struct blk_header
+  {
+    uint32_t type;              /* BLK_T_IN or BLK_T_OUT. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+
+/* One request in flight, which uses descriptors 3*i, 3*i+1, and
+   3*i+2 if it is slot I. */
+struct slot
+  {
+    struct blk_header header;   /* Read by the device. */
+    uint8_t status;             /* Written by the device. */
+    struct block_request *r;    /* Request being carried out. */
+  };
+
+/* A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* BAR 0 I/O port base. */
+    uint8_t irq;                /* Interrupt in use. */
+
+    uint16_t queue_size;        /* Descriptors in the virtqueue. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    struct vring_used *used;    /* Used ring. */
+    uint16_t last_used;         /* Next used ring entry to look at. */
+
+    struct slot *slots;         /* SLOT_CNT slots, in their own page. */
+    size_t slot_cnt;            /* Usable slots, at most SLOT_CNT. */
+    int free_slots[SLOT_CNT];   /* Stack of unused slot numbers. */
+    size_t free_cnt;            /* Number of entries in FREE_SLOTS. */
+    struct lock lock;           /* Guards the rings and FREE_SLOTS. */
+    struct semaphore slot_sema; /* Counts unused slots. */
+    struct semaphore irq_sema;  /* Up'd by interrupt handler. */
+  };
+
+static struct virtio_disk disks[DISK_CNT];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static bool setup_disk (struct virtio_disk *, const struct pci_dev *);
+static void interrupt_handler (struct intr_frame *);
+static void completion_thread (void *d_);
+
+/* Detects virtio block devices and registers each as a block
+   device, "vda" through "vdd". */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  int i;
+
+  for (i = 0; disk_cnt < DISK_CNT
+         && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, i, &pci); i++)
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+      uint32_t capacity_hi;
+      block_sector_t capacity;
+      struct block *block;
+      char thread_name[16];
+      size_t j;
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (!setup_disk (d, &pci))
+        continue;
+
+      /* Capacity is in 512-byte sectors, whatever the block size. */
+      capacity = inl (reg_capacity (d));
+      capacity_hi = inl (reg_capacity (d) + 4);
+      if (capacity_hi != 0)
+        {
+          printf ("%s: ignoring disk over 2 TB\n", d->name);
+          outb (reg_status (d), STATUS_FAILED);
+          continue;
+        }
+
+      /* Share the interrupt line with any disk before us on it. */
+      for (j = 0; j < disk_cnt; j++)
+        if (disks[j].irq == d->irq)
+          break;
+      if (j == disk_cnt)
+        intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+      disk_cnt++;
+
+      snprintf (thread_name, sizeof thread_name, "%s-done", d->name);
+      thread_create (thread_name, PRI_MAX, completion_thread, d);
+      outb (reg_status (d),
+            STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+      block = block_register (d->name, BLOCK_RAW, "virtio", capacity,
+                              &virtio_blk_operations, d);
+      partition_scan (block);
+    }
+}
+
+/* Resets the device at PCI, negotiates no optional features, and
+   sets up its single virtqueue for disk D.  Returns true if
+   successful, false if the device is unusable. */
+static bool
+setup_disk (struct virtio_disk *d, const struct pci_dev *pci)
+{
+  uint8_t line = pci_irq (pci);
+  size_t desc_size, avail_size, used_size, page_cnt, i;
+  uint8_t *ring;
+
+  d->io_base = pci_io_bar (pci, 0);
+  if (d->io_base == 0 || line >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt, ignoring\n", d->name);
+      return false;
+    }
+  d->irq = line + 0x20;
+  pci_enable_bus_master (pci);
+
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_device_features (d));
+  outl (reg_guest_features (d), 0);
+
+  /* The legacy layout puts the descriptor table and available
+     ring in one run of pages and the used ring on the next page
+     boundary, all physically contiguous. */
+  outw (reg_queue_select (d), 0);
+  d->queue_size = inw (reg_queue_size (d));
+  if (d->queue_size < 3)
+    {
+      printf ("%s: no usable virtqueue, ignoring\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return false;
+    }
+  desc_size = d->queue_size * sizeof *d->desc;
+  avail_size = sizeof *d->avail + (d->queue_size + 1) * sizeof (uint16_t);
+  used_size = (sizeof *d->used + d->queue_size * sizeof *d->used->ring
+               + sizeof (uint16_t));
+  page_cnt = (DIV_ROUND_UP (desc_size + avail_size, VRING_ALIGN)
+              + DIV_ROUND_UP (used_size, VRING_ALIGN));
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  d->slots = palloc_get_page (PAL_ZERO);
+  if (ring == NULL || d->slots == NULL)
+    PANIC ("%s: out of memory for virtqueue", d->name);
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + desc_size);
+  d->used = (struct vring_used *) (ring + ROUND_UP (desc_size + avail_size,
+                                                    VRING_ALIGN));
+  d->last_used = 0;
+  outl (reg_queue_pfn (d), vtop (ring) / VRING_ALIGN);
+
+  d->slot_cnt = d->queue_size / 3 < SLOT_CNT ? d->queue_size / 3 : SLOT_CNT;
+  for (i = 0; i < d->slot_cnt; i++)
+    d->free_slots[i] = d->slot_cnt - 1 - i;
+  d->free_cnt = d->slot_cnt;
+  lock_init (&d->lock);
+  sema_init (&d->slot_sema, d->slot_cnt);
+  sema_init (&d->irq_sema, 0);
+  return true;
+}
+
+/* Starts request R on disk D by chaining its header, data, and
+   status through a free slot's descriptors and notifying the
+   device.  Waits for a slot if all are in flight. */
+static void
+virtio_blk_submit (void *d_, struct block_request *r)
+{
+  struct virtio_disk *d = d_;
+  struct slot *slot;
+  struct vring_desc *desc;
+  int i;
+
+  ASSERT (is_kernel_vaddr (r->buffer));
+
+  sema_down (&d->slot_sema);
+  lock_acquire (&d->lock);
+  i = d->free_slots[--d->free_cnt];
+  slot = &d->slots[i];
+  slot->header.type = r->write ? BLK_T_OUT : BLK_T_IN;
+  slot->header.reserved = 0;
+  slot->header.sector = r->sector;
+  slot->status = 0xff;
+  slot->r = r;
+
+  desc = &d->desc[3 * i];
+  desc[0].addr = vtop (&slot->header);
+  desc[0].len = sizeof slot->header;
+  desc[0].flags = DESC_NEXT;
+  desc[0].next = 3 * i + 1;
+  desc[1].addr = vtop (r->buffer);
+  desc[1].len = r->cnt * BLOCK_SECTOR_SIZE;
+  desc[1].flags = DESC_NEXT | (r->write ? 0 : DESC_WRITE);
+  desc[1].next = 3 * i + 2;
+  desc[2].addr = vtop (&slot->status);
+  desc[2].len = 1;
+  desc[2].flags = DESC_WRITE;
+  desc[2].next = 0;
+
+  /* The device may look at the ring as soon as IDX moves, so the
+     entry must be written first. */
+  d->avail->ring[d->avail->idx % d->queue_size] = 3 * i;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (reg_queue_notify (d), 0);
+  lock_release (&d->lock);
+}
+
+/* Completes every request that disk D has returned in its used
+   ring, each time its interrupt handler wakes us. */
+static void
+completion_thread (void *d_)
+{
+  struct virtio_disk *d = d_;
+
+  for (;;)
+    {
+      sema_down (&d->irq_sema);
+      for (;;)
+        {
+          struct block_request *r;
+          struct slot *slot;
+          int i;
+
+          lock_acquire (&d->lock);
+          barrier ();
+          if (d->last_used == d->used->idx)
+            {
+              lock_release (&d->lock);
+              break;
+            }
+          i = d->used->ring[d->last_used++ % d->queue_size].id / 3;
+          slot = &d->slots[i];
+          r = slot->r;
+          if (slot->status != BLK_S_OK)
+            PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+                   r->write ? "write" : "read", r->sector);
+          d->free_slots[d->free_cnt++] = i;
+          lock_release (&d->lock);
+
+          sema_up (&d->slot_sema);
+          block_complete (r);
+        }
+    }
+}
+
+/* Reads sector SECTOR from disk D into BUFFER. */
+static void
+virtio_blk_read (void *d, block_sector_t sector, void *buffer)
+{
+  struct block_request r;
+
+  r.sector = sector;
+  r.cnt = 1;
+  r.buffer = buffer;
+  r.write = false;
+  r.complete = NULL;
+  sema_init (&r.done, 0);
+  virtio_blk_submit (d, &r);
+  block_wait (&r);
+}
+
+/* Writes sector SECTOR to disk D from BUFFER. */
+static void
+virtio_blk_write (void *d, block_sector_t sector, const void *buffer)
+{
+  struct block_request r;
+
+  r.sector = sector;
+  r.cnt = 1;
+  r.buffer = (void *) buffer;
+  r.write = true;
+  r.complete = NULL;
+  sema_init (&r.done, 0);
+  virtio_blk_submit (d, &r);
+  block_wait (&r);
+}
+
+/* virtio block interrupt handler, shared by all disks on the
+   same line.  Reading a disk's ISR register acknowledges it. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    if (f->vec_no == disks[i].irq && (inb (reg_isr (&disks[i])) & 1))
+      sema_up (&disks[i].irq_sema);
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    virtio_blk_read,
+    virtio_blk_write,
+    NULL,
+    NULL,
+    virtio_blk_submit
+  };
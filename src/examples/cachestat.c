@@ -0,0 +1,31 @@
+/* cachestat.c
+
+   Prints the kernel's buffer cache statistics. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (void)
+{
+  struct cache_stat st;
+  unsigned long long accesses;
+
+  if (!cache_stat (&st))
+    {
+      printf ("cachestat: cache_stat failed\n");
+      return EXIT_FAILURE;
+    }
+
+  accesses = st.hits + st.misses;
+  printf ("size:            %u sectors\n", st.size);
+  printf ("hits:            %llu\n", st.hits);
+  printf ("misses:          %llu\n", st.misses);
+  printf ("hit rate:        %llu%%\n", accesses ? st.hits * 100 / accesses : 0);
+  printf ("evictions:       %llu\n", st.evictions);
+  printf ("writebacks:      %llu\n", st.writebacks);
+  printf ("read-aheads:     %llu\n", st.read_aheads);
+  printf ("read-ahead hits: %llu\n", st.read_ahead_hits);
+  printf ("probes/lookup:   %llu/%llu\n", st.probes, st.lookups);
+  return EXIT_SUCCESS;
+}
@@ -1,21 +1,108 @@
 #include "filesys/cache.h"
+#include "filesys/free-map.h"
+#include "threads/loader.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include <debug.h>
+#include <round.h>
+#include <stdlib.h>
 #include <string.h>
 
 //variables given
-struct buffer_cache_entry cache[NUM_CACHE];
+struct buffer_cache_entry *cache;   //buffer_cache_size entries, from palloc
 struct lock buffer_cache_lock;
 
+int buffer_cache_size;
+
 struct buffer_cache_entry* clk; //replacement by clock
 
+//sector -> entry index, chained by hash_elem, guarded by buffer_cache_lock
+static struct list *cache_hash;
+static size_t cache_bucket_cnt;    //power of 2
+static struct condition cache_unpinned;    //signaled when a pin_cnt drops to 0
+
+//claimed victims whose old contents are still being written back,
+//so a miss on one of their old sectors waits instead of reading
+//a stale copy from disk; guarded by buffer_cache_lock
+static struct list cache_writeback;
+static struct condition cache_written_back;  //signaled as each one finishes
+
+//2Q-style segments: new sectors start cold and are only promoted
+//to hot when hit again well after their fill, so a large scan
+//cycles through the cold entries and leaves hot ones alone
+static int hot_cnt;                 //entries with hot set
+static unsigned cache_fill_cnt;     //misses so far, to age fill_stamp
+
+static struct cache_stat stats;     //guarded by buffer_cache_lock
+
+int read_ahead_window = 4;
+
+//ring of sectors waiting for the read-ahead thread
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static int read_ahead_head, read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_nonempty;
+
+static struct buffer_cache_entry *buffer_cache_acquire(block_sector_t, bool);
+static struct buffer_cache_entry *buffer_cache_claim(block_sector_t, bool);
+static bool buffer_cache_in_writeback(block_sector_t);
+static void buffer_cache_write_back(struct buffer_cache_entry *);
+static void buffer_cache_release(struct buffer_cache_entry *);
+static void buffer_cache_unpin(struct buffer_cache_entry *);
+static void buffer_cache_promote(struct buffer_cache_entry *);
+static void read_ahead_thread(void *);
+static void write_behind_thread(void *);
+
+/* Returns PAGE_CNT pages from the kernel pool, panicking if the
+   requested cache does not fit. */
+static void *buffer_cache_alloc(size_t page_cnt){
+    void *pages = palloc_get_multiple(0, page_cnt);
+    if (pages == NULL)
+        PANIC("no memory for a %d-sector buffer cache", buffer_cache_size);
+    return pages;
+}
+
 void buffer_cache_init(void){
-    for (int i = 0; i < NUM_CACHE; ++i){
+    uint8_t *buffers;
+
+    if (buffer_cache_size <= 0)
+        buffer_cache_size = init_ram_pages / CACHE_RAM_SHARE * (PGSIZE / BLOCK_SECTOR_SIZE);
+    if (buffer_cache_size < NUM_CACHE)
+        buffer_cache_size = NUM_CACHE;
+    for (cache_bucket_cnt = 1; cache_bucket_cnt < (size_t)buffer_cache_size * 2; )
+        cache_bucket_cnt <<= 1;
+
+    cache = buffer_cache_alloc(DIV_ROUND_UP(buffer_cache_size * sizeof *cache, PGSIZE));
+    buffers = buffer_cache_alloc(DIV_ROUND_UP(buffer_cache_size * BLOCK_SECTOR_SIZE, PGSIZE));
+    cache_hash = buffer_cache_alloc(DIV_ROUND_UP(cache_bucket_cnt * sizeof *cache_hash, PGSIZE));
+    for (int i = 0; i < buffer_cache_size; ++i){
         memset(&cache[i], 0, sizeof(struct buffer_cache_entry));
         lock_init(&cache[i].lock_per_entry);
+        cache[i].buffer = buffers + i * BLOCK_SECTOR_SIZE;
     }
+    for (size_t i = 0; i < cache_bucket_cnt; ++i)
+        list_init(&cache_hash[i]);
     lock_init(&buffer_cache_lock);
+    cond_init(&cache_unpinned);
+    list_init(&cache_writeback);
+    cond_init(&cache_written_back);
     clk = cache;
+    hot_cnt = 0;
+    cache_fill_cnt = 0;
+    memset(&stats, 0, sizeof stats);
+    stats.size = buffer_cache_size;
+
+    lock_init(&read_ahead_lock);
+    cond_init(&read_ahead_nonempty);
+    read_ahead_head = read_ahead_cnt = 0;
+    if (read_ahead_window > READ_AHEAD_QUEUE)
+        read_ahead_window = READ_AHEAD_QUEUE;
+    if (read_ahead_window > 0)
+        thread_create("read-ahead", PRI_DEFAULT, read_ahead_thread, NULL);
+    thread_create("write-behind", PRI_DEFAULT, write_behind_thread, NULL);
 }
 
 void buffer_cache_terminate(void){
@@ -24,114 +111,448 @@ void buffer_cache_terminate(void){
 }
 
 bool buffer_cache_read(block_sector_t sec, void* buf, off_t pos, int size, int sector_pos){
-    struct buffer_cache_entry *tmp = buffer_cache_lookup(sec);
-    if (tmp) {
-        lock_acquire(&tmp->lock_per_entry);
-        memcpy(buf + pos, tmp->buffer + sector_pos, size);
-        tmp->reference_bit = true;
-        lock_release(&tmp->lock_per_entry);
+    struct buffer_cache_entry *tmp = buffer_cache_acquire(sec, true);
+    memcpy((uint8_t *)buf + pos, tmp->buffer + sector_pos, size);
+    tmp->reference_bit = true;
+    buffer_cache_release(tmp);
+    return true;
+}
 
-    }
-    else{
-        lock_acquire(&buffer_cache_lock);
-        struct buffer_cache_entry* target = buffer_cache_select_victim();
-        lock_acquire(&target->lock_per_entry);
-        buffer_cache_flush_entry(target);
-        target->valid_bit = true;
-        target->reference_bit = true;
-        target->dirty_bit = false;
-        target->disk_sector = sec;
-
-        block_read(fs_device, sec, target->buffer);
-        memcpy(buf + pos, target->buffer + sector_pos, size);
-
-        lock_release(&target->lock_per_entry);
-        lock_release(&buffer_cache_lock);
-    }
+
+bool buffer_cache_write(block_sector_t sec, const void* buf, off_t pos, int size, int sector_pos){
+    //no need to read the old contents if they are overwritten entirely
+    bool whole = sector_pos == 0 && size == BLOCK_SECTOR_SIZE;
+    struct buffer_cache_entry *tmp = buffer_cache_acquire(sec, !whole);
+    memcpy(tmp->buffer + sector_pos, (const uint8_t *)buf + pos, size);
+    tmp->reference_bit = true;
+    tmp->dirty_bit = true;
+    buffer_cache_release(tmp);
     return true;
 }
 
+/* Returns the cache entry for SEC, pinned so it cannot be evicted
+   and locked for the caller's exclusive use.  The sector's bytes
+   are at e->buffer and may be read or modified in place until the
+   matching buffer_cache_put().  Do not get an entry while holding
+   another one that a different thread may get in reverse order. */
+struct buffer_cache_entry *buffer_cache_get(block_sector_t sec){
+    return buffer_cache_acquire(sec, true);
+}
 
-bool buffer_cache_write(block_sector_t sec, void* buf, off_t pos, int size, int sector_pos){
-    struct buffer_cache_entry *tmp = buffer_cache_lookup(sec);
-    if (tmp){
-        lock_acquire(&tmp->lock_per_entry);
-        memcpy(tmp->buffer + sector_pos, buf + pos, size);
-        tmp->reference_bit = true;
-        tmp->dirty_bit = true;
-        lock_release(&tmp->lock_per_entry);
+/* Like buffer_cache_get(), but for a freshly allocated SEC whose
+   old contents do not matter: skips the disk read and returns a
+   zeroed buffer. */
+struct buffer_cache_entry *buffer_cache_get_new(block_sector_t sec){
+    struct buffer_cache_entry *e = buffer_cache_acquire(sec, false);
+    memset(e->buffer, 0, BLOCK_SECTOR_SIZE);
+    return e;
+}
+
+/* Releases an entry from buffer_cache_get(), marking it dirty if
+   the caller modified e->buffer. */
+void buffer_cache_put(struct buffer_cache_entry *e, bool dirty){
+    e->reference_bit = true;
+    if (dirty)
+        e->dirty_bit = true;
+    buffer_cache_release(e);
+}
 
+/* Returns the hash chain that SEC belongs to. */
+static struct list *buffer_cache_bucket(block_sector_t sec){
+    return &cache_hash[sec & (cache_bucket_cnt - 1)];
+}
+
+/* Returns the entry caching SEC, or NULL if it is not cached.
+   Caller must hold buffer_cache_lock. */
+struct buffer_cache_entry *buffer_cache_lookup(block_sector_t sec){
+    struct list *bucket = buffer_cache_bucket(sec);
+    struct list_elem *e;
+
+    ASSERT(lock_held_by_current_thread(&buffer_cache_lock));
+    stats.lookups++;
+    for (e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+        struct buffer_cache_entry *tmp = list_entry(e, struct buffer_cache_entry, hash_elem);
+        stats.probes++;
+        if (tmp->disk_sector == sec)
+            return tmp;
     }
-    else{
-        lock_acquire(&buffer_cache_lock);
-        struct buffer_cache_entry* target = buffer_cache_select_victim();
-        lock_acquire(&target->lock_per_entry);
-        buffer_cache_flush_entry(target);
-        target->valid_bit = true;
-        target->reference_bit = true;
-        target->dirty_bit = true;
-        target->disk_sector = sec;
-
-        block_read(fs_device, sec, target->buffer);
-        memcpy(target->buffer + sector_pos, buf + pos, size);
-
-        lock_release(&target->lock_per_entry);
+    return NULL;
+}
+
+/* Returns the entry caching SEC, pinned and with its lock held.
+   On a miss a victim is recycled and, if FILL, read from disk;
+   otherwise the caller must overwrite the whole buffer.
+   buffer_cache_lock is only held while the index is probed or
+   updated; the victim's writeback and the disk read happen under
+   the entry lock alone, so concurrent hits on the same sector wait
+   for them to finish. */
+static struct buffer_cache_entry *buffer_cache_acquire(block_sector_t sec, bool fill){
+    struct buffer_cache_entry *tmp;
+
+    lock_acquire(&buffer_cache_lock);
+    //an evicted copy of SEC still on its way out is newer than the disk
+    while ((tmp = buffer_cache_lookup(sec)) == NULL && buffer_cache_in_writeback(sec))
+        cond_wait(&cache_written_back, &buffer_cache_lock);
+    if (tmp) {
+        stats.hits++;
+        if (tmp->prefetched)
+            stats.read_ahead_hits++;
+        tmp->prefetched = false;
+        tmp->pin_cnt++;
+        if (cache_fill_cnt - tmp->fill_stamp > PROMOTE_DISTANCE)
+            buffer_cache_promote(tmp);
         lock_release(&buffer_cache_lock);
+        lock_acquire(&tmp->lock_per_entry);
+        return tmp;
     }
-    return true;
+
+    tmp = buffer_cache_claim(sec, false);
+    lock_release(&buffer_cache_lock);
+
+    buffer_cache_write_back(tmp);
+    if (fill)
+        block_read(fs_device, sec, tmp->buffer);
+    return tmp;
 }
 
+/* Recycles a victim entry for the uncached SEC and returns it
+   pinned and locked, indexed under SEC but with SEC not yet read
+   in.  If the victim was dirty it is put on the writeback list,
+   and the caller must pass it to buffer_cache_write_back() after
+   releasing buffer_cache_lock, before reusing the buffer.  PREFETCH
+   marks a fill on behalf of the read-ahead thread.  Caller must
+   hold buffer_cache_lock, which is still held on return. */
+static struct buffer_cache_entry *buffer_cache_claim(block_sector_t sec, bool prefetch){
+    struct buffer_cache_entry *tmp = buffer_cache_select_victim();
+    //unpinned, so nobody else holds or waits on its lock: every
+    //path pins an entry before taking its lock
+    if (tmp->valid_bit) {
+        list_remove(&tmp->hash_elem);
+        stats.evictions++;
+        if (tmp->dirty_bit) {
+            tmp->writing_back = true;
+            tmp->old_sector = tmp->disk_sector;
+            list_push_back(&cache_writeback, &tmp->writeback_elem);
+        }
+    }
+    if (prefetch)
+        stats.read_aheads++;
+    else
+        stats.misses++;
+    tmp->prefetched = prefetch;
+    tmp->valid_bit = true;
+    tmp->dirty_bit = false;
+    tmp->disk_sector = sec;
+    tmp->pin_cnt = 1;
+    tmp->hot = tmp->meta = false;
+    tmp->fill_stamp = ++cache_fill_cnt;
+    list_push_front(buffer_cache_bucket(sec), &tmp->hash_elem);
+    lock_acquire(&tmp->lock_per_entry);
+    return tmp;
+}
 
-struct buffer_cache_entry *buffer_cache_lookup(block_sector_t sec){
-    int i;
+/* Returns true if a claimed victim is still writing SEC back.
+   Caller must hold buffer_cache_lock. */
+static bool buffer_cache_in_writeback(block_sector_t sec){
+    struct list_elem *e;
+
+    for (e = list_begin(&cache_writeback); e != list_end(&cache_writeback); e = list_next(e))
+        if (list_entry(e, struct buffer_cache_entry, writeback_elem)->old_sector == sec)
+            return true;
+    return false;
+}
+
+/* Writes the old contents of E, just returned by
+   buffer_cache_claim(), back to the sector E held before, if it
+   was dirty, and wakes any thread waiting to read that sector.
+   Called with E's lock held but not buffer_cache_lock. */
+static void buffer_cache_write_back(struct buffer_cache_entry *e){
+    if (!e->writing_back)
+        return;
+    block_write(fs_device, e->old_sector, e->buffer);
+    lock_acquire(&buffer_cache_lock);
+    e->writing_back = false;
+    list_remove(&e->writeback_elem);
+    stats.writebacks++;
+    cond_broadcast(&cache_written_back, &buffer_cache_lock);
+    lock_release(&buffer_cache_lock);
+}
+
+/* Unlocks and unpins an entry returned by buffer_cache_acquire(). */
+static void buffer_cache_release(struct buffer_cache_entry *e){
+    lock_release(&e->lock_per_entry);
+    buffer_cache_unpin(e);
+}
+
+/* Drops a pin on E taken under buffer_cache_lock. */
+static void buffer_cache_unpin(struct buffer_cache_entry *e){
     lock_acquire(&buffer_cache_lock);
-    for (i = 0; i < NUM_CACHE; i++) //find appropriate cache
-        if (cache[i].valid_bit && cache[i].disk_sector == sec)
-            break;
+    if (--e->pin_cnt == 0)
+        cond_signal(&cache_unpinned, &buffer_cache_lock);
     lock_release(&buffer_cache_lock);
-    if (i >= NUM_CACHE) return NULL;
-    else return &cache[i];
 }
 
+/* Moves E into the hot segment.  Caller must hold buffer_cache_lock. */
+static void buffer_cache_promote(struct buffer_cache_entry *e){
+    if (!e->hot) {
+        e->hot = true;
+        hot_cnt++;
+    }
+}
+
+/* Marks the cached SEC as file system metadata (an inode, index
+   table, directory or free-map sector), which is kept hot and
+   outlives plain data under pressure.  Does nothing if SEC is not
+   cached.  May be called while holding SEC's entry. */
+void buffer_cache_mark_meta(block_sector_t sec){
+    struct buffer_cache_entry *e;
+
+    lock_acquire(&buffer_cache_lock);
+    e = buffer_cache_lookup(sec);
+    if (e) {
+        e->meta = true;
+        buffer_cache_promote(e);
+    }
+    lock_release(&buffer_cache_lock);
+}
+
+/* Picks an unpinned entry by a two-segment clock and returns it,
+   waiting for one to be unpinned if every entry is in use.
+   The hand evicts cold entries (preferring clean ones on the first
+   sweep) and only ages hot entries, demoting them to cold while
+   the hot segment is over HOT_LIMIT or nothing cold is left.
+   Caller must hold buffer_cache_lock. */
 struct buffer_cache_entry *buffer_cache_select_victim(void){
-    struct buffer_cache_entry* victim;
-    bool flag = false;
-
-    for (;!flag;clk++) {
-        if (clk == cache + NUM_CACHE) clk = cache; //rotate cache space
-        lock_acquire(&clk->lock_per_entry);
-        if (!clk->valid_bit || !clk->reference_bit){
-            victim = clk;
-            lock_release(&clk->lock_per_entry);
-            flag = true;
-            continue;
+    struct buffer_cache_entry* victim = NULL;
+    int scanned = 0;
+
+    while (victim == NULL) {
+        if (clk == cache + buffer_cache_size) clk = cache; //rotate cache space
+        bool pressure = scanned >= buffer_cache_size;
+        if (clk->pin_cnt == 0) {
+            if (!clk->valid_bit)
+                victim = clk;
+            else if (clk->hot) {
+                if (clk->reference_bit)
+                    clk->reference_bit = false;
+                else if (clk->meta && !pressure)
+                    clk->meta = false;
+                else if (hot_cnt > HOT_LIMIT || pressure) {
+                    clk->hot = false;
+                    hot_cnt--;
+                }
+            }
+            else if (clk->reference_bit)
+                clk->reference_bit = false;
+            //leave dirty entries to write-behind on the first sweep
+            else if (!clk->dirty_bit || pressure)
+                victim = clk;
+        }
+        clk++;
+        if (victim == NULL && ++scanned >= 4 * buffer_cache_size) {
+            cond_wait(&cache_unpinned, &buffer_cache_lock);
+            scanned = 0;
         }
-        clk->reference_bit = false;
-        lock_release(&clk->lock_per_entry);
     }
     return victim;
-    /*
-    while (1){
-        clk=cache;
-        lock_acquire(&clk->lock);
-        if (!clk->valid_bit || !clk->reference_bit)
-        lock_release(&clk->lock);
-    }*/
 }
 
-void buffer_cache_flush_entry(struct buffer_cache_entry *e){
+/* Writes E back if it is dirty and returns true if it did.  Caller
+   must hold E's lock or otherwise own E exclusively. */
+bool buffer_cache_flush_entry(struct buffer_cache_entry *e){
     if (e->valid_bit&&e->dirty_bit){
         e->dirty_bit = false;
         block_write(fs_device, e->disk_sector, e->buffer);
-        for (int i=0;i<BLOCK_SECTOR_SIZE;i++)
-            e->buffer[i]=NULL;
+        return true;
     }
+    return false;
 }
 
-void buffer_cache_flush_all(){
-    for (int i = 0; i < NUM_CACHE; i++) {
+/* Adds CNT to the writeback counter. */
+static void count_writebacks(int cnt){
+    lock_acquire(&buffer_cache_lock);
+    stats.writebacks += cnt;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Writes back every dirty entry, waiting for entries in use.
+   Each one is pinned before its lock is taken, so that
+   buffer_cache_claim() never picks it and waits on that lock
+   while holding buffer_cache_lock. */
+void buffer_cache_flush_all(void){
+    int written = 0;
+    for (int i = 0; i < buffer_cache_size; i++) {
+        lock_acquire(&buffer_cache_lock);
+        cache[i].pin_cnt++;
+        lock_release(&buffer_cache_lock);
         lock_acquire(&cache[i].lock_per_entry);
-        buffer_cache_flush_entry(&cache[i]);
-        lock_release(&cache[i].lock_per_entry);
+        written += buffer_cache_flush_entry(&cache[i]);
+        buffer_cache_release(&cache[i]);
+    }
+    count_writebacks(written);
+}
+
+/* Orders pinned entries by sector, for qsort(). */
+static int compare_sectors(const void *a_, const void *b_){
+    const struct buffer_cache_entry *a = *(struct buffer_cache_entry * const *) a_;
+    const struct buffer_cache_entry *b = *(struct buffer_cache_entry * const *) b_;
+    return a->disk_sector < b->disk_sector ? -1 : a->disk_sector > b->disk_sector;
+}
+
+/* Writes back every dirty entry.  The writes are submitted in
+   sector order, all before waiting for any, so that a disk without
+   a request queue makes one sweep and one with a queue can merge
+   adjacent sectors.  Entries that are in use are skipped and left
+   for the next pass.  Entries stay cached (and clean) afterwards. */
+void buffer_cache_flush_dirty(void){
+    struct buffer_cache_entry **dirty;
+    struct block_request *req;
+    int cnt = 0, written = 0;
+
+    dirty = malloc(buffer_cache_size * sizeof *dirty);
+    req = malloc(buffer_cache_size * sizeof *req);
+    if (dirty == NULL || req == NULL) {
+        free(dirty);
+        free(req);
+        return;
+    }
+    lock_acquire(&buffer_cache_lock);
+    for (int i = 0; i < buffer_cache_size; i++)
+        if (cache[i].valid_bit && cache[i].dirty_bit) {
+            cache[i].pin_cnt++;
+            dirty[cnt++] = &cache[i];
+        }
+    lock_release(&buffer_cache_lock);
+
+    //pinned, so their sectors cannot change under the sort
+    qsort(dirty, cnt, sizeof *dirty, compare_sectors);
+
+    //never wait for an entry lock while holding others
+    for (int i = 0; i < cnt; i++) {
+        struct buffer_cache_entry *e = dirty[i];
+        if (!lock_try_acquire(&e->lock_per_entry)) {
+            buffer_cache_unpin(e);
+            continue;
+        }
+        if (!e->dirty_bit) {
+            buffer_cache_release(e);
+            continue;
+        }
+        e->dirty_bit = false;
+        req[written].sector = e->disk_sector;
+        req[written].cnt = 1;
+        req[written].buffer = e->buffer;
+        req[written].write = true;
+        req[written].complete = NULL;
+        block_submit(fs_device, &req[written]);
+        dirty[written++] = e;
+    }
+    for (int i = 0; i < written; i++) {
+        block_wait(&req[i]);
+        buffer_cache_release(dirty[i]);
+    }
+    free(req);
+    free(dirty);
+    count_writebacks(written);
+}
+
+/* Periodically cleans the cache in the background, so eviction
+   rarely has to write before it can read and a crash loses at
+   most WRITE_BEHIND_PERIOD ticks of writes.  Free map changes are
+   put in the cache first so that they go out in the same pass. */
+static void write_behind_thread(void *aux UNUSED){
+    for (;;) {
+        timer_sleep(WRITE_BEHIND_PERIOD);
+        free_map_flush();
+        buffer_cache_flush_dirty();
     }
-}
\ No newline at end of file
+}
+
+/* Asks the read-ahead thread to bring SEC into the cache.
+   Never blocks on I/O; the request is dropped if the queue is
+   full, since read-ahead is only a hint. */
+void buffer_cache_read_ahead(block_sector_t sec){
+    if (read_ahead_window <= 0)
+        return;
+    lock_acquire(&read_ahead_lock);
+    if (read_ahead_cnt < READ_AHEAD_QUEUE) {
+        read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE] = sec;
+        read_ahead_cnt++;
+        cond_signal(&read_ahead_nonempty, &read_ahead_lock);
+    }
+    lock_release(&read_ahead_lock);
+}
+
+/* Fills cache entries for queued sectors ahead of the readers.
+   Up to CACHE_IO_RUN consecutive queued sectors are claimed at
+   once and read with one request each, all submitted before
+   waiting, which the disk queue merges into a single transfer.
+   Prefetched entries are left unreferenced, so a wrong guess is
+   the first thing the clock evicts. */
+static void read_ahead_thread(void *aux UNUSED){
+    struct buffer_cache_entry *run[CACHE_IO_RUN];
+    struct block_request req[CACHE_IO_RUN];
+
+    for (;;) {
+        block_sector_t sec;
+        int sec_cnt, cnt = 0;
+
+        lock_acquire(&read_ahead_lock);
+        while (read_ahead_cnt == 0)
+            cond_wait(&read_ahead_nonempty, &read_ahead_lock);
+        sec = read_ahead_queue[read_ahead_head];
+        for (sec_cnt = 0; sec_cnt < CACHE_IO_RUN && read_ahead_cnt > 0
+                 && read_ahead_queue[read_ahead_head] == sec + sec_cnt; sec_cnt++) {
+            read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+            read_ahead_cnt--;
+        }
+        lock_release(&read_ahead_lock);
+
+        //entries claimed here are unpinned victims, so locking them
+        //under buffer_cache_lock cannot wait on anyone
+        lock_acquire(&buffer_cache_lock);
+        for (int i = 0; i < sec_cnt; i++)
+            if (buffer_cache_lookup(sec + i) == NULL && !buffer_cache_in_writeback(sec + i))
+                run[cnt++] = buffer_cache_claim(sec + i, true);
+        lock_release(&buffer_cache_lock);
+
+        for (int i = 0; i < cnt; i++) {
+            buffer_cache_write_back(run[i]);
+            req[i].sector = run[i]->disk_sector;
+            req[i].cnt = 1;
+            req[i].buffer = run[i]->buffer;
+            req[i].write = false;
+            req[i].complete = NULL;
+            block_submit(fs_device, &req[i]);
+        }
+        for (int i = 0; i < cnt; i++) {
+            block_wait(&req[i]);
+            buffer_cache_release(run[i]);
+        }
+    }
+}
+
+/* Copies the cache counters into *ST. */
+void buffer_cache_get_stat(struct cache_stat *st){
+    lock_acquire(&buffer_cache_lock);
+    *st = stats;
+    lock_release(&buffer_cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void buffer_cache_print_stats(void){
+    struct cache_stat st;
+    unsigned long long accesses, probes_x100;
+
+    if (cache == NULL)
+        return;     //shutting down before the file system came up
+    buffer_cache_get_stat(&st);
+    accesses = st.hits + st.misses;
+    probes_x100 = st.lookups ? st.probes * 100 / st.lookups : 0;
+    printf("Buffer cache: %u sectors, %llu hits, %llu misses (%llu%% hit rate)\n",
+           st.size, st.hits, st.misses, accesses ? st.hits * 100 / accesses : 0);
+    printf("Buffer cache: %llu evictions, %llu writebacks, "
+           "%llu read-aheads (%llu hit), %llu.%02llu probes/lookup\n",
+           st.evictions, st.writebacks, st.read_aheads, st.read_ahead_hits,
+           probes_x100 / 100, probes_x100 % 100);
+}
@@ -1,4 +1,14 @@
-#define NUM_CACHE 64
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+#define NUM_CACHE 64            //smallest cache size, in sectors
+#define CACHE_RAM_SHARE 32      //default size is 1/CACHE_RAM_SHARE of RAM
+#define READ_AHEAD_QUEUE 64     //pending read-ahead requests
+#define WRITE_BEHIND_PERIOD 100 //ticks between write-behind passes
+#define CACHE_IO_RUN 8          //most sectors the read-ahead thread fetches at once
+#define HOT_LIMIT (buffer_cache_size * 3 / 4)       //share of the cache kept hot
+#define PROMOTE_DISTANCE ((unsigned) buffer_cache_size / 4) //fills before a re-hit counts
+#include <cache-stat.h>
+#include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
@@ -11,15 +21,41 @@ struct buffer_cache_entry
     bool reference_bit;
     bool dirty_bit;
     block_sector_t disk_sector;
+    struct list_elem hash_elem;     //element in the sector hash chain
+    int pin_cnt;                    //users of this entry, never evicted while > 0
+    bool hot;                       //re-used after its first touch, or metadata
+    bool meta;                      //metadata, gets an extra lap while hot
+    unsigned fill_stamp;            //cache_fill_cnt when this entry was filled
+    bool prefetched;                //filled by read-ahead, not yet used
+    bool writing_back;              //old contents still going out to old_sector
+    block_sector_t old_sector;      //sector it held before being claimed
+    struct list_elem writeback_elem; //element in the writeback list
     struct lock lock_per_entry;
-    uint8_t buffer[BLOCK_SECTOR_SIZE];
+    uint8_t *buffer;                //BLOCK_SECTOR_SIZE bytes of cached data
 };
 
+/* -cache: Number of cache entries, 0 to size from RAM.  Holds the
+   actual size once the cache is initialized. */
+extern int buffer_cache_size;
+
+/* -ra: Sectors to read ahead of a sequential reader, 0 disables. */
+extern int read_ahead_window;
+
 void buffer_cache_init(void);
 void buffer_cache_terminate(void);
 bool buffer_cache_read(block_sector_t, void*, off_t, int, int);
-bool buffer_cache_write(block_sector_t, void*, off_t, int, int);
+bool buffer_cache_write(block_sector_t, const void*, off_t, int, int);
+struct buffer_cache_entry *buffer_cache_get(block_sector_t);
+struct buffer_cache_entry *buffer_cache_get_new(block_sector_t);
+void buffer_cache_put(struct buffer_cache_entry *, bool);
+void buffer_cache_mark_meta(block_sector_t);
 struct buffer_cache_entry *buffer_cache_lookup(block_sector_t);
 struct buffer_cache_entry *buffer_cache_select_victim(void);
-void buffer_cache_flush_entry(struct buffer_cache_entry *);
-void buffer_cache_flush_all();
\ No newline at end of file
+bool buffer_cache_flush_entry(struct buffer_cache_entry *);
+void buffer_cache_flush_all(void);
+void buffer_cache_flush_dirty(void);
+void buffer_cache_read_ahead(block_sector_t);
+void buffer_cache_get_stat(struct cache_stat *);
+void buffer_cache_print_stats(void);
+
+#endif /* filesys/cache.h */
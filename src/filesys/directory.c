@@ -1,13 +1,202 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include "filesys/free-map.h"
 
 /* A single directory entry. */
 struct dir_entry
 {
-    block_sector_t inode_sector; /* Sector number of header. */
+    block_sector_t inode_sector; /* Sector number of header, or next free slot + 1 if indexed. */
     char name[NAME_MAX + 1];     /* Null terminated file name. */
     bool in_use;                 /* In use or free? */
 };
 
+/* Dentry cache: recent name lookups, keyed by the directory's
+   sector and the name, so that resolving a path again does not
+   scan its directories.  A lookup that found nothing is cached too,
+   as sector 0, which no file can have. */
+#define DCACHE_SIZE 256
+
+struct dcache_entry
+{
+    struct hash_elem hash_elem;  /* Element in dcache. */
+    struct list_elem lru_elem;   /* Element in dcache_lru. */
+    block_sector_t parent;       /* Directory's inode sector. */
+    char name[NAME_MAX + 1];     /* Name looked up in it. */
+    block_sector_t sector;       /* File's inode sector, or 0 if none. */
+};
+
+static struct hash dcache;
+static struct list dcache_lru;   /* Most recently used first. */
+static struct lock dcache_lock;  /* Guards dcache, dcache_lru and dcache_gen. */
+static unsigned dcache_gen;      /* Bumped by each directory change. */
+
+static unsigned dcache_hash(const struct hash_elem *e_, void *aux UNUSED)
+{
+    const struct dcache_entry *e = hash_entry(e_, struct dcache_entry, hash_elem);
+    return hash_string(e->name) ^ hash_int(e->parent);
+}
+
+static bool dcache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct dcache_entry *a = hash_entry(a_, struct dcache_entry, hash_elem);
+    const struct dcache_entry *b = hash_entry(b_, struct dcache_entry, hash_elem);
+    if (a->parent != b->parent)
+        return a->parent < b->parent;
+    return strcmp(a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void dir_init(void)
+{
+    hash_init(&dcache, dcache_hash, dcache_less, NULL);
+    list_init(&dcache_lru);
+    lock_init(&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in the directory at sector
+   PARENT, or a null pointer.  Called with dcache_lock held. */
+static struct dcache_entry *dcache_find(block_sector_t parent, const char *name)
+{
+    struct dcache_entry key;
+    struct hash_elem *e;
+
+    key.parent = parent;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dcache, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory at sector PARENT in the dentry
+   cache.  If it is there, stores the file's sector, or 0 if there
+   is no such file, in *SECTOR and returns true.  Otherwise stores
+   the current generation in *GEN for dcache_fill(). */
+static bool dcache_get(block_sector_t parent, const char *name, block_sector_t *sector,
+                       unsigned *gen)
+{
+    struct dcache_entry *e;
+
+    lock_acquire(&dcache_lock);
+    e = dcache_find(parent, name);
+    if (e != NULL)
+    {
+        *sector = e->sector;
+        list_remove(&e->lru_elem);
+        list_push_front(&dcache_lru, &e->lru_elem);
+    }
+    else
+        *gen = dcache_gen;
+    lock_release(&dcache_lock);
+    return e != NULL;
+}
+
+/* Records that NAME in the directory at sector PARENT is the file
+   at SECTOR, or no file if SECTOR is 0, evicting the least
+   recently used entry if the cache is full.  Called with
+   dcache_lock held. */
+static void dcache_store(block_sector_t parent, const char *name, block_sector_t sector)
+{
+    struct dcache_entry *e;
+
+    e = dcache_find(parent, name);
+    if (e != NULL)
+        list_remove(&e->lru_elem);
+    else
+    {
+        if (hash_size(&dcache) >= DCACHE_SIZE)
+        {
+            e = list_entry(list_back(&dcache_lru), struct dcache_entry, lru_elem);
+            list_remove(&e->lru_elem);
+            hash_delete(&dcache, &e->hash_elem);
+        }
+        else
+            e = malloc(sizeof *e);
+        if (e == NULL)
+            return;
+        e->parent = parent;
+        strlcpy(e->name, name, sizeof e->name);
+        hash_insert(&dcache, &e->hash_elem);
+    }
+    e->sector = sector;
+    list_push_front(&dcache_lru, &e->lru_elem);
+}
+
+/* Records the result of a directory change, which is already on
+   disk, and invalidates lookups that started before it. */
+static void dcache_put(block_sector_t parent, const char *name, block_sector_t sector)
+{
+    lock_acquire(&dcache_lock);
+    dcache_gen++;
+    dcache_store(parent, name, sector);
+    lock_release(&dcache_lock);
+}
+
+/* Records the result of a lookup that missed the cache at
+   generation GEN, unless a directory changed since then, in which
+   case the result may already be stale. */
+static void dcache_fill(block_sector_t parent, const char *name, block_sector_t sector,
+                        unsigned gen)
+{
+    lock_acquire(&dcache_lock);
+    if (gen == dcache_gen)
+        dcache_store(parent, name, sector);
+    lock_release(&dcache_lock);
+}
+
+/* Drops every cached entry of the directory at sector PARENT,
+   whose sector may be reused once it is removed. */
+static void dcache_forget_dir(block_sector_t parent)
+{
+    struct list_elem *l, *next;
+
+    lock_acquire(&dcache_lock);
+    dcache_gen++;
+    for (l = list_begin(&dcache_lru); l != list_end(&dcache_lru); l = next)
+    {
+        struct dcache_entry *e = list_entry(l, struct dcache_entry, lru_elem);
+        next = list_next(l);
+        if (e->parent == parent)
+        {
+            list_remove(&e->lru_elem);
+            hash_delete(&dcache, &e->hash_elem);
+            free(e);
+        }
+    }
+    lock_release(&dcache_lock);
+}
+
+/* A directory with this many entry slots gets an index: a hashed
+   table from names to slots, kept in a file of its own, so that a
+   lookup reads a header, a bucket and an entry instead of the
+   whole directory. */
+#define DIR_INDEX_THRESHOLD 128
+#define DIR_INDEX_MAGIC 0x44494458
+#define BUCKET_SLOTS 63         /* Entries per bucket sector. */
+#define BUCKET_LOAD 32          /* Average bucket fill at which the index is rebuilt bigger. */
+
+/* Start of sector 0 of an index.  Buckets are sectors 1 to
+   BUCKET_CNT, overflow buckets follow them. */
+struct index_header
+{
+    unsigned magic;
+    uint32_t bucket_cnt;         /* Buckets a name can hash to. */
+    uint32_t entry_cnt;          /* Entries indexed. */
+    uint32_t sector_cnt;         /* Sectors in use, overflow buckets included. */
+    uint32_t free_slot;          /* First free entry slot + 1, or 0. */
+};
+
+/* One bucket sector.  A bucket past the end of the index file
+   reads as zeros, which is an empty bucket. */
+struct index_bucket
+{
+    uint32_t cnt;                /* Slots in use. */
+    uint32_t next;               /* Overflow bucket's sector, or 0. */
+    struct
+    {
+        uint32_t hash;           /* hash_string() of the name. */
+        uint32_t slot;           /* Entry slot in the directory. */
+    } slots[BUCKET_SLOTS];
+};
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt)
@@ -65,6 +254,227 @@ dir_get_inode(struct dir *dir)
     return dir->inode;
 }
 
+/* Reads bucket sector N of INDEX into B. */
+static void read_bucket(struct inode *index, uint32_t n, struct index_bucket *b)
+{
+    memset(b, 0, sizeof *b);
+    inode_read_at(index, b, sizeof *b, n * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes B to bucket sector N of INDEX.  Returns true if successful. */
+static bool write_bucket(struct inode *index, uint32_t n, const struct index_bucket *b)
+{
+    return inode_write_at(index, b, sizeof *b, n * BLOCK_SECTOR_SIZE) == sizeof *b;
+}
+
+/* Opens the index of DIR and reads its header into H.  Returns a
+   null pointer if DIR has no index. */
+static struct inode *open_index(const struct dir *dir, struct index_header *h)
+{
+    block_sector_t sector = inode_get_index(dir->inode);
+    struct inode *index;
+
+    if (sector == 0)
+        return NULL;
+    index = inode_open(sector);
+    if (index != NULL
+        && (inode_read_at(index, h, sizeof *h, 0) != sizeof *h || h->magic != DIR_INDEX_MAGIC))
+    {
+        inode_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+/* Adds SLOT, holding a name whose hash is HASH, to INDEX, whose
+   header is H.  Returns true if successful. */
+static bool index_insert(struct inode *index, struct index_header *h, unsigned hash, uint32_t slot)
+{
+    struct index_bucket *b = malloc(sizeof *b);
+    uint32_t n = 1 + hash % h->bucket_cnt;
+    bool success = false;
+
+    if (b == NULL)
+        return false;
+    for (;;)
+    {
+        read_bucket(index, n, b);
+        if (b->cnt < BUCKET_SLOTS || b->next == 0)
+            break;
+        n = b->next;
+    }
+    if (b->cnt == BUCKET_SLOTS)
+    {
+        /* Chain an overflow bucket. */
+        b->next = h->sector_cnt++;
+        if (!write_bucket(index, n, b))
+            goto done;
+        n = b->next;
+        memset(b, 0, sizeof *b);
+    }
+    b->slots[b->cnt].hash = hash;
+    b->slots[b->cnt].slot = slot;
+    b->cnt++;
+    success = write_bucket(index, n, b);
+    if (success)
+        h->entry_cnt++;
+
+done:
+    free(b);
+    return success;
+}
+
+/* Removes SLOT, holding a name whose hash is HASH, from INDEX,
+   whose header is H. */
+static void index_delete(struct inode *index, struct index_header *h, unsigned hash, uint32_t slot)
+{
+    struct index_bucket *b = malloc(sizeof *b);
+    uint32_t n, k;
+
+    if (b == NULL)
+        return;
+    for (n = 1 + hash % h->bucket_cnt; n != 0; n = b->next)
+    {
+        read_bucket(index, n, b);
+        for (k = 0; k < b->cnt; k++)
+            if (b->slots[k].hash == hash && b->slots[k].slot == slot)
+            {
+                b->slots[k] = b->slots[--b->cnt];
+                write_bucket(index, n, b);
+                h->entry_cnt--;
+                free(b);
+                return;
+            }
+    }
+    free(b);
+}
+
+/* Searches INDEX, the index of DIR whose header is H, for NAME,
+   like lookup(). */
+static bool index_lookup(const struct dir *dir, struct inode *index, const struct index_header *h,
+                         const char *name, struct dir_entry *ep, off_t *ofsp)
+{
+    struct index_bucket *b = malloc(sizeof *b);
+    unsigned hash = hash_string(name);
+    struct dir_entry e;
+    uint32_t n, k;
+
+    if (b == NULL)
+        return false;
+    for (n = 1 + hash % h->bucket_cnt; n != 0; n = b->next)
+    {
+        read_bucket(index, n, b);
+        for (k = 0; k < b->cnt; k++)
+        {
+            off_t ofs = b->slots[k].slot * sizeof e;
+            if (b->slots[k].hash == hash
+                && inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e
+                && e.in_use && !strcmp(name, e.name))
+            {
+                if (ep != NULL)
+                    *ep = e;
+                if (ofsp != NULL)
+                    *ofsp = ofs;
+                free(b);
+                return true;
+            }
+        }
+    }
+    free(b);
+    return false;
+}
+
+/* Builds a new index of DIR from its entries, sized for them, and
+   replaces its old index, if any, with it.  Free slots are chained
+   into the index's free list.  Returns true if successful. */
+static bool build_index(struct dir *dir)
+{
+    struct index_header h;
+    struct dir_entry e;
+    struct inode *index, *old;
+    block_sector_t sector, old_sector = inode_get_index(dir->inode);
+    uint32_t slot, slot_cnt = inode_length(dir->inode) / sizeof e;
+    bool success = true;
+
+    h.magic = DIR_INDEX_MAGIC;
+    h.bucket_cnt = 8;
+    while (h.bucket_cnt * BUCKET_LOAD / 2 < slot_cnt)
+        h.bucket_cnt *= 2;
+    h.entry_cnt = 0;
+    h.sector_cnt = 1 + h.bucket_cnt;
+    h.free_slot = 0;
+
+    if (!free_map_allocate_near(1, inode_get_inumber(dir->inode), &sector))
+        return false;
+    if (!inode_create(sector, 0, false) || (index = inode_open(sector)) == NULL)
+    {
+        free_map_release(sector, 1);
+        return false;
+    }
+
+    for (slot = 0; success && slot < slot_cnt; slot++)
+    {
+        inode_read_at(dir->inode, &e, sizeof e, slot * sizeof e);
+        if (e.in_use)
+            success = index_insert(index, &h, hash_string(e.name), slot);
+        else
+        {
+            e.inode_sector = h.free_slot;
+            h.free_slot = slot + 1;
+            success = inode_write_at(dir->inode, &e, sizeof e, slot * sizeof e) == sizeof e;
+        }
+    }
+    success = success && inode_write_at(index, &h, sizeof h, 0) == sizeof h;
+    if (!success)
+    {
+        inode_remove(index);
+        inode_close(index);
+        return false;
+    }
+    inode_close(index);
+
+    inode_set_index(dir->inode, sector);
+    if (old_sector != 0 && (old = inode_open(old_sector)) != NULL)
+    {
+        inode_remove(old);
+        inode_close(old);
+    }
+    return true;
+}
+
+/* Adds an entry for NAME, whose inode is in INODE_SECTOR, to DIR,
+   whose index is INDEX with header H.  The entry takes a free slot
+   if there is one.  The index is rebuilt bigger once its buckets
+   fill up.  Returns true if successful. */
+static bool index_add(struct dir *dir, struct inode *index, struct index_header *h,
+                      const char *name, block_sector_t inode_sector)
+{
+    struct dir_entry e;
+    uint32_t slot;
+
+    if (h->free_slot != 0)
+    {
+        slot = h->free_slot - 1;
+        if (inode_read_at(dir->inode, &e, sizeof e, slot * sizeof e) != sizeof e)
+            return false;
+        h->free_slot = e.inode_sector;
+    }
+    else
+        slot = inode_length(dir->inode) / sizeof e;
+
+    e.in_use = true;
+    strlcpy(e.name, name, sizeof e.name);
+    e.inode_sector = inode_sector;
+    if (inode_write_at(dir->inode, &e, sizeof e, slot * sizeof e) != sizeof e
+        || !index_insert(index, h, hash_string(name), slot)
+        || inode_write_at(index, h, sizeof *h, 0) != sizeof *h)
+        return false;
+
+    if (h->entry_cnt > h->bucket_cnt * BUCKET_LOAD)
+        build_index(dir);
+    return true;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -73,11 +483,21 @@ dir_get_inode(struct dir *dir)
 static bool lookup(const struct dir *dir, const char *name, struct dir_entry *ep, off_t *ofsp)
 {
     struct dir_entry e;
+    struct index_header h;
+    struct inode *index;
     size_t ofs;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    index = open_index(dir, &h);
+    if (index != NULL)
+    {
+        bool found = index_lookup(dir, index, &h, name, ep, ofsp);
+        inode_close(index);
+        return found;
+    }
+
     for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
          ofs += sizeof e)
         if (e.in_use && !strcmp(name, e.name))
@@ -98,14 +518,22 @@ static bool lookup(const struct dir *dir, const char *name, struct dir_entry *ep
 bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode)
 {
     struct dir_entry e;
+    block_sector_t parent, sector;
+    unsigned gen;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    if (lookup(dir, name, &e, NULL))
-        *inode = inode_open(e.inode_sector);
-    else
-        *inode = NULL;
+    /* No entry has a name longer than NAME_MAX. */
+    parent = inode_get_inumber(dir->inode);
+    if (strlen(name) > NAME_MAX)
+        sector = 0;
+    else if (!dcache_get(parent, name, &sector, &gen))
+    {
+        sector = lookup(dir, name, &e, NULL) ? e.inode_sector : 0;
+        dcache_fill(parent, name, sector, gen);
+    }
+    *inode = sector != 0 ? inode_open(sector) : NULL;
 
     return *inode != NULL;
 }
@@ -119,6 +547,8 @@ bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode)
 bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
 {
     struct dir_entry e;
+    struct index_header h;
+    struct inode *index;
     off_t ofs;
     bool success = false;
 
@@ -133,6 +563,15 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
     if (lookup(dir, name, NULL, NULL))
         goto done;
 
+    /* An indexed directory knows its free slots. */
+    index = open_index(dir, &h);
+    if (index != NULL)
+    {
+        success = index_add(dir, index, &h, name, inode_sector);
+        inode_close(index);
+        goto done;
+    }
+
     /* Set OFS to offset of free slot.
        If there are no free slots, then it will be set to the
        current end-of-file.
@@ -151,7 +590,13 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector)
     e.inode_sector = inode_sector;
     success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+    /* Index the directory once scanning it gets costly. */
+    if (success && inode_length(dir->inode) / sizeof e >= DIR_INDEX_THRESHOLD)
+        build_index(dir);
+
 done:
+    if (success)
+        dcache_put(inode_get_inumber(dir->inode), name, inode_sector);
     return success;
 }
 
@@ -161,8 +606,10 @@ done:
 bool dir_remove(struct dir *dir, const char *name)
 {
     struct dir_entry e;
-    struct inode *inode = NULL;
-    bool success = false;
+    struct index_header h;
+    struct inode *inode = NULL, *index;
+    block_sector_t sector;
+    bool success = false, is_dir;
     off_t ofs;
 
     ASSERT(dir != NULL);
@@ -170,6 +617,7 @@ bool dir_remove(struct dir *dir, const char *name)
 
     if (!strncmp(name, ".", 1))
         return false;
+    index = open_index(dir, &h);
     /* Find directory entry. */
     if (!lookup(dir, name, &e, &ofs))
         goto done;
@@ -178,17 +626,35 @@ bool dir_remove(struct dir *dir, const char *name)
     inode = inode_open(e.inode_sector);
     if (inode == NULL)
         goto done;
+    sector = inode_get_inumber(inode);
+    is_dir = is_direc(inode);
 
-    /* Erase directory entry. */
+    /* Erase directory entry, putting its slot on the free list
+       of an index. */
     e.in_use = false;
+    if (index != NULL)
+    {
+        e.inode_sector = h.free_slot;
+        h.free_slot = ofs / sizeof e + 1;
+    }
     if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
         goto done;
+    if (index != NULL)
+    {
+        index_delete(index, &h, hash_string(name), ofs / sizeof e);
+        inode_write_at(index, &h, sizeof h, 0);
+    }
 
-    /* Remove inode. */
+    /* Remove inode.  A removed directory's sector may come back as
+       another one, so its entries go too. */
     inode_remove(inode);
+    if (is_dir)
+        dcache_forget_dir(sector);
+    dcache_put(inode_get_inumber(dir->inode), name, 0);
     success = true;
 
 done:
+    inode_close(index);
     inode_close(inode);
     return success;
 }
@@ -23,6 +23,8 @@ struct dir {
 	struct inode* inode;
 	off_t pos;
 };
+void dir_init(void);
+
 /* Opening and closing directories. */
 bool dir_create(block_sector_t sector, size_t entry_cnt);
 struct dir* dir_open(struct inode*);
@@ -27,6 +27,7 @@ void filesys_init(bool format)
     buffer_cache_init();
 
     inode_init();
+    dir_init();
     free_map_init();
 
     if (format)
@@ -40,8 +41,9 @@ void filesys_init(bool format)
    to disk. */
 void filesys_done(void)
 {
-    buffer_cache_terminate();
+    inode_done();
     free_map_close();
+    buffer_cache_terminate();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -53,7 +55,8 @@ bool filesys_create(const char *name, off_t initial_size)
     block_sector_t sec = 0;
     char* parsed = (char*)malloc(PATH_LENGTH);
     struct dir* dir = get_path(name, parsed);
-    bool flag = (dir != NULL && free_map_allocate(1, &sec)
+    bool flag = (dir != NULL
+        && free_map_allocate_near(1, inode_get_inumber(dir_get_inode(dir)), &sec)
         && inode_create(sec, initial_size, false)
         && dir_add(dir, parsed, sec));
     if (!flag && sec != 0)
@@ -173,7 +176,7 @@ bool filesys_create_dir(char *name)
     char* parsed = (char*)malloc(PATH_LENGTH);
     struct dir* direc = get_path(name, parsed);
     block_sector_t sec = 0;
-    bool flag = (direc && free_map_allocate(1, &sec) && dir_create(sec, 16) && dir_add(direc, parsed, sec));
+    bool flag = (direc && free_map_allocate_dir(&sec) && dir_create(sec, 16) && dir_add(direc, parsed, sec));
 
     if (!flag) {
         if (sec) free_map_release(sec, 1);
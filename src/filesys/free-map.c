@@ -4,9 +4,99 @@
 #include "filesys/inode.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Free map bits held by one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+/* Sectors per block group, the unit allocation keeps related
+   sectors in.  One group's bits fill one free map file sector. */
+#define GROUP_SECTORS BITS_PER_SECTOR
 
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per sector. */
+static struct bitmap *free_map_dirty; /* Free map file sectors not yet written. */
+static struct lock free_map_lock;  /* Guards free_map and free_map_dirty. */
+static block_sector_t free_map_next; /* Where free_map_allocate() looks first. */
+static size_t group_cnt;           /* Number of block groups. */
+static size_t *group_free;         /* Free sectors in each group. */
+
+/* Recounts the free sectors of every block group. */
+static void count_groups(void)
+{
+    size_t g;
+
+    for (g = 0; g < group_cnt; g++) {
+        size_t start = g * GROUP_SECTORS;
+        size_t cnt = bitmap_size(free_map) - start < GROUP_SECTORS ? bitmap_size(free_map) - start : GROUP_SECTORS;
+        group_free[g] = bitmap_count(free_map, start, cnt, false);
+    }
+}
+
+/* Updates the free counts of the groups that the CNT sectors
+   starting at SECTOR fall in, which were just FREED or taken. */
+static void adjust_groups(block_sector_t sector, size_t cnt, bool freed)
+{
+    while (cnt > 0) {
+        size_t g = sector / GROUP_SECTORS;
+        size_t n = (g + 1) * GROUP_SECTORS - sector;
+        if (n > cnt)
+            n = cnt;
+        if (freed)
+            group_free[g] += n;
+        else
+            group_free[g] -= n;
+        sector += n;
+        cnt -= n;
+    }
+}
+
+/* Returns the first run of CNT free sectors that starts in the
+   group of HINT at or after HINT, or else in the following groups
+   in turn, wrapping around.  Groups with too few free sectors are
+   passed over without scanning, and each scan stops at the end of
+   its group.  A run longer than a group is looked for anywhere
+   after HINT, then from the start of the disk. */
+static block_sector_t scan_groups(size_t cnt, block_sector_t hint)
+{
+    size_t first = hint / GROUP_SECTORS;
+    size_t k;
+
+    if (cnt > GROUP_SECTORS) {
+        size_t sector = bitmap_scan(free_map, hint, cnt, false);
+        return sector != BITMAP_ERROR ? sector : bitmap_scan(free_map, 0, cnt, false);
+    }
+    for (k = 0; k <= group_cnt; k++) {
+        size_t g = (first + k) % group_cnt;
+        size_t start = g * GROUP_SECTORS;
+        size_t end = start + GROUP_SECTORS;
+        size_t sector;
+
+        //the first group is scanned from HINT, and again in full last
+        if (k == 0)
+            start = hint;
+        if (end > bitmap_size(free_map))
+            end = bitmap_size(free_map);
+        if (group_free[g] < cnt)
+            continue;
+        sector = bitmap_scan_range(free_map, start, end, cnt, false);
+        if (sector != BITMAP_ERROR)
+            return sector;
+    }
+    return BITMAP_ERROR;
+}
+
+/* Notes that the bits for the CNT sectors starting at SECTOR
+   changed and must be written to the free map file. */
+static void mark_dirty(block_sector_t sector, size_t cnt)
+{
+    size_t first = sector / BITS_PER_SECTOR;
+    size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+    bitmap_set_multiple(free_map_dirty, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void free_map_init(void)
@@ -16,32 +106,92 @@ void free_map_init(void)
         PANIC("bitmap creation failed--file system device is too large");
     bitmap_mark(free_map, FREE_MAP_SECTOR);
     bitmap_mark(free_map, ROOT_DIR_SECTOR);
+    free_map_dirty = bitmap_create(DIV_ROUND_UP(bitmap_size(free_map), BITS_PER_SECTOR));
+    group_cnt = DIV_ROUND_UP(bitmap_size(free_map), GROUP_SECTORS);
+    group_free = malloc(group_cnt * sizeof *group_free);
+    if (free_map_dirty == NULL || group_free == NULL)
+        PANIC("bitmap creation failed--file system device is too large");
+    count_groups();
+    lock_init(&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The search starts where the last
+   allocation ended, so the full start of a busy disk is not
+   rescanned every time.  The change reaches the free map file at
+   the next free_map_flush(). */
 bool free_map_allocate(size_t cnt, block_sector_t *sectorp)
 {
-    block_sector_t sector = bitmap_scan_and_flip(free_map, 0, cnt, false);
-    if (sector != BITMAP_ERROR && free_map_file != NULL && !bitmap_write(free_map, free_map_file))
-    {
-        bitmap_set_multiple(free_map, sector, cnt, false);
-        sector = BITMAP_ERROR;
+    return free_map_allocate_near(cnt, free_map_next, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first run at or after
+   sector HINT in its block group, or else in the groups that
+   follow, so that a file stays next to its inode and a growing
+   file stays in one place.  A HINT past the end of the disk means
+   no preference. */
+bool free_map_allocate_near(size_t cnt, block_sector_t hint, block_sector_t *sectorp)
+{
+    block_sector_t sector;
+
+    lock_acquire(&free_map_lock);
+    if (hint >= bitmap_size(free_map))
+        hint = free_map_next < bitmap_size(free_map) ? free_map_next : 0;
+    sector = scan_groups(cnt, hint);
+    if (sector != BITMAP_ERROR) {
+        bitmap_set_multiple(free_map, sector, cnt, true);
+        adjust_groups(sector, cnt, false);
+        mark_dirty(sector, cnt);
+        free_map_next = sector + cnt;
     }
+    lock_release(&free_map_lock);
     if (sector != BITMAP_ERROR)
         *sectorp = sector;
     return sector != BITMAP_ERROR;
 }
 
+/* Allocates the inode sector of a new directory in the block group
+   with the most free sectors and stores it into *SECTORP, so that
+   directories, and the files created in them, spread out over the
+   disk.  Returns true if successful. */
+bool free_map_allocate_dir(block_sector_t *sectorp)
+{
+    size_t g, best = 0;
+
+    lock_acquire(&free_map_lock);
+    for (g = 1; g < group_cnt; g++)
+        if (group_free[g] > group_free[best])
+            best = g;
+    lock_release(&free_map_lock);
+    return free_map_allocate_near(1, best * GROUP_SECTORS, sectorp);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release(block_sector_t sector, size_t cnt)
 {
+    lock_acquire(&free_map_lock);
     ASSERT(bitmap_all(free_map, sector, cnt));
     bitmap_set_multiple(free_map, sector, cnt, false);
-    bitmap_write(free_map, free_map_file);
+    adjust_groups(sector, cnt, true);
+    mark_dirty(sector, cnt);
+    lock_release(&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose bits changed since
+   they were last written. */
+void free_map_flush(void)
+{
+    size_t s;
+
+    lock_acquire(&free_map_lock);
+    if (free_map_file != NULL)
+        for (s = bitmap_scan(free_map_dirty, 0, 1, true); s != BITMAP_ERROR;
+            s = bitmap_scan(free_map_dirty, s + 1, 1, true))
+            if (bitmap_write_range(free_map, free_map_file, s * BITS_PER_SECTOR, BITS_PER_SECTOR))
+                bitmap_reset(free_map_dirty, s);
+    lock_release(&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -52,12 +202,23 @@ void free_map_open(void)
         PANIC("can't open free map");
     if (!bitmap_read(free_map, free_map_file))
         PANIC("can't read free map");
+    bitmap_set_all(free_map_dirty, false);
+    count_groups();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void free_map_close(void)
 {
-    file_close(free_map_file);
+    struct file *file;
+
+    free_map_flush();
+
+    /* Keep the write-behind thread from flushing to a closed file. */
+    lock_acquire(&free_map_lock);
+    file = free_map_file;
+    free_map_file = NULL;
+    lock_release(&free_map_lock);
+    file_close(file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -74,4 +235,5 @@ void free_map_create(void)
         PANIC("can't open free map");
     if (!bitmap_write(free_map, free_map_file))
         PANIC("can't write free map");
+    bitmap_set_all(free_map_dirty, false);
 }
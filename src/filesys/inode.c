@@ -1,6 +1,7 @@
 #define INODE_MAGIC 0x494e4f44
 #define SECTOR_MAGIC 0xffffffff
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -12,85 +13,181 @@
 #include "filesys/cache.h"
 
 
-/* In-memory inode. */
+/* In-memory inode.  ELEM and SECTOR come first, as in struct
+   inode_key. */
 struct inode
 {
-    struct list_elem elem; /* Element in inode list. */
+    struct hash_elem elem; /* Element in open_inodes. */
     block_sector_t sector; /* Sector number of disk location. */
+    bool loading;          /* DATA not read in yet, under open_inodes_lock. */
     int open_cnt;          /* Number of openers. */
     bool removed;          /* True if deleted, false otherwise. */
     int deny_write_cnt;    /* 0: writes ok, >0: deny writes. */
-    //struct inode_disk data;
     struct lock lock_inode;
+    off_t ra_next;         /* Offset a sequential reader reads next. */
+    off_t ra_end;          /* Read-ahead has been queued up to here. */
+    struct inode_disk data;        /* Resident copy of the on-disk inode, under lock_inode. */
+    struct lock lock_extents;      /* Guards the extent block copy below. */
+    block_sector_t ext_sector;     /* Extent block last looked up, or SECTOR_MAGIC. */
+    size_t ext_first;              /* File sector its first extent maps. */
+    struct extent_block ext_block; /* Copy of that extent block. */
+    block_sector_t pre_start;      /* Sectors reserved for growth, under lock_inode, */
+    size_t pre_cnt;                /* or where the next reservation should go. */
 };
 
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t byte_to_sector(const struct inode_disk *i, off_t pos)
+/* Gets metadata sector SEC from the buffer cache, telling the cache
+   to keep it in preference to file data. */
+static struct buffer_cache_entry* get_meta(block_sector_t sec)
 {
-    //ASSERT (inode != NULL);
-    struct sector_index sec_idx;
-    if (pos >= i->length) return -1;
-    set_sector_index(pos, &sec_idx);
-    switch (sec_idx.kind) {
-    case 0:
-        return i->table_direct[sec_idx.idx1];
-        break;
-    case 1:
-    {
-        block_sector_t retsec;
-        struct indirect_inode* ind = (struct indirect_inode*)malloc(BLOCK_SECTOR_SIZE);
-        block_sector_t sec = i->sector_indirect;
-        if (sec == SECTOR_MAGIC) {
-            free(ind);
-            return -1;
-            break;
+    struct buffer_cache_entry* e = buffer_cache_get(sec);
+    buffer_cache_mark_meta(sec);
+    return e;
+}
+
+/* Looks up sector *IDX among the CNT extents EXT.  On success
+   stores the disk sector, or SECTOR_MAGIC inside a hole, in *SEC
+   and returns true, otherwise subtracts the sectors the extents
+   map from *IDX. */
+static bool search_extents(const struct extent* ext, uint32_t cnt, size_t* idx, block_sector_t* sec)
+{
+    for (uint32_t k = 0; k < cnt; k++) {
+        if (*idx < ext[k].length) {
+            *sec = ext[k].start == SECTOR_MAGIC ? SECTOR_MAGIC : ext[k].start + *idx;
+            return true;
         }
-        buffer_cache_read(sec, ind, 0, sizeof(struct indirect_inode), 0);
-        retsec = ind->table[sec_idx.idx1];
-        free(ind);
+        *idx -= ext[k].length;
+    }
+    return false;
+}
+
+/* Returns the disk sector that maps sector IDX of INODE, whose
+   on-disk inode is I, or SECTOR_MAGIC if IDX is in a hole or the
+   file maps fewer sectors.  The extent block that held the answer
+   is kept in INODE, so a reader moving through a large file reads
+   the chain only when it crosses into the next block.  Growth only
+   appends extents and never changes what the copy maps; filling a
+   hole does, and drops the copy. */
+static block_sector_t extent_lookup(struct inode* inode, const struct inode_disk* i, size_t idx)
+{
+    block_sector_t next = i->extent_next;
+    block_sector_t retsec = SECTOR_MAGIC;
+    size_t rel = idx, first;
+
+    if (search_extents(i->extents, i->extent_cnt, &rel, &retsec))
         return retsec;
-        break;
+    first = idx - rel;      //file sector the chain starts at
+
+    lock_acquire(&inode->lock_extents);
+    if (inode->ext_sector != SECTOR_MAGIC && idx >= inode->ext_first) {
+        rel = idx - inode->ext_first;
+        if (search_extents(inode->ext_block.extents, inode->ext_block.extent_cnt, &rel, &retsec)) {
+            lock_release(&inode->lock_extents);
+            return retsec;
+        }
+        //past the copy, which may be older than the block: go on from the block itself
+        next = inode->ext_sector;
+        first = inode->ext_first;
     }
-    case 2:
-    {
-        block_sector_t retsec;
-        struct indirect_inode* ind = (struct indirect_inode*)malloc(BLOCK_SECTOR_SIZE);
-        block_sector_t sec = i->sector_double_indirect;
-        if (sec == SECTOR_MAGIC) {
-            free(ind);
-            return -1;
-            break;
+    while (next != SECTOR_MAGIC) {
+        struct buffer_cache_entry* e = get_meta(next);
+        const struct extent_block* b = (const struct extent_block*)e->buffer;
+        bool found;
+
+        rel = idx - first;
+        found = search_extents(b->extents, b->extent_cnt, &rel, &retsec);
+        if (found) {
+            inode->ext_sector = next;
+            inode->ext_first = first;
+            memcpy(&inode->ext_block, b, sizeof inode->ext_block);
         }
-		buffer_cache_read(sec, ind, 0, sizeof(struct indirect_inode), 0);
-        sec = ind->table[sec_idx.idx1];
-        if (sec == SECTOR_MAGIC) {
-            free(ind);
-            return -1;
+        first = idx - rel;
+        next = b->next;
+        buffer_cache_put(e, false);
+        if (found)
             break;
-        }
-        buffer_cache_read(sec, ind, 0, sizeof(struct indirect_inode), 0);
-        retsec = ind->table[sec_idx.idx2];
-        free(ind);
-        return retsec;
-        break;
-    }
     }
+    lock_release(&inode->lock_extents);
+    return retsec;
+}
 
-    return -1;
+/* Returns the block device sector that contains byte offset POS
+   within INODE, whose on-disk inode is I.
+   Returns -1 if INODE does not contain data for a byte at offset
+   POS. */
+static block_sector_t byte_to_sector(struct inode *inode, const struct inode_disk *i, off_t pos)
+{
+    if (pos >= i->length) return -1;
+    return extent_lookup(inode, i, pos / BLOCK_SECTOR_SIZE);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+static void read_ahead(struct inode *, const struct inode_disk *, off_t, off_t);
+static bool fill_hole(struct inode *, size_t, size_t);
+static bool inline_to_extents(struct inode *);
+static bool grow_sparse(struct inode_disk *, off_t);
+static bool trim_sparse(struct inode *, off_t);
+
+/* Returns true if the contents of INODE, whose on-disk inode is
+   I_DISK, are file system metadata: a directory or the free map. */
+static bool is_meta_data(const struct inode *inode, const struct inode_disk *i_disk)
+{
+    return i_disk->isdir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Open inodes keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  open_inodes_lock also
+   guards the open counts.  An inode is inserted before its sector
+   is read, with loading set, so the read happens without the lock;
+   anyone else opening it meanwhile waits on inode_loaded. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct condition inode_loaded;
+
+/* The start of struct inode, which is all the hash functions look
+   at, so that a lookup key fits on the stack. */
+struct inode_key
+{
+    struct hash_elem elem;
+    block_sector_t sector;
+};
+
+static unsigned inode_hash(const struct hash_elem* e, void* aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct inode_key, elem)->sector);
+}
+
+static bool inode_less(const struct hash_elem* a, const struct hash_elem* b, void* aux UNUSED)
+{
+    return hash_entry(a, struct inode_key, elem)->sector < hash_entry(b, struct inode_key, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void inode_init(void)
 {
-    list_init(&open_inodes);
+    ASSERT(offsetof(struct inode, elem) == offsetof(struct inode_key, elem));
+    ASSERT(offsetof(struct inode, sector) == offsetof(struct inode_key, sector));
+    hash_init(&open_inodes, inode_hash, inode_less, NULL);
+    lock_init(&open_inodes_lock);
+    cond_init(&inode_loaded);
+}
+
+/* Gives back the preallocation windows of the inodes still open,
+   so that the free map saved at shutdown does not keep them. */
+void inode_done(void)
+{
+    struct hash_iterator i;
+
+    lock_acquire(&open_inodes_lock);
+    hash_first(&i, &open_inodes);
+    while (hash_next(&i)) {
+        struct inode* inode = hash_entry(hash_cur(&i), struct inode, elem);
+        lock_acquire(&inode->lock_inode);
+        if (inode->pre_cnt > 0)
+            free_map_release(inode->pre_start, inode->pre_cnt);
+        inode->pre_cnt = 0;
+        lock_release(&inode->lock_inode);
+    }
+    lock_release(&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -112,13 +209,23 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir)
     disk_inode = calloc(1, sizeof * disk_inode);
     if (disk_inode != NULL)
     {
-        //size_t sectors = bytes_to_sectors (length);
-        init_sector_indirect(disk_inode);
+        bool tmp = true;
         disk_inode->isdir = is_dir;
         disk_inode->magic = INODE_MAGIC;
-        bool tmp = update_inode(disk_inode, disk_inode->length, length);
+        if (length <= INODE_INLINE_BYTES) {
+            disk_inode->inlined = true;
+            disk_inode->length = length;
+        }
+        else {
+            disk_inode->extent_next = SECTOR_MAGIC;
+            tmp = update_inode(NULL, sector, disk_inode, disk_inode->length, length);
+            //give back whatever was mapped before the disk filled up
+            if (!tmp)
+                free_sectors_inode(disk_inode);
+        }
         if (tmp) {
             buffer_cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE, 0);
+            buffer_cache_mark_meta(sector);
             success = true;
         }
         free(disk_inode);
@@ -131,32 +238,54 @@ bool inode_create(block_sector_t sector, off_t length, bool is_dir)
    Returns a null pointer if memory allocation fails. */
 struct inode *inode_open(block_sector_t sector)
 {
-    struct list_elem* e;
+    struct hash_elem* e;
     struct inode* inode;
+    struct inode_key key;
+
     /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-        e = list_next(e))
+    lock_acquire(&open_inodes_lock);
+    key.sector = sector;
+    e = hash_find(&open_inodes, &key.elem);
+    if (e != NULL)
     {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector)
-        {
-            inode_reopen(inode);
-            return inode;
-        }
+        inode = hash_entry(e, struct inode, elem);
+        inode->open_cnt++;
+        while (inode->loading)
+            cond_wait(&inode_loaded, &open_inodes_lock);
+        lock_release(&open_inodes_lock);
+        return inode;
     }
 
     /* Allocate memory. */
     inode = malloc(sizeof * inode);
-    if (inode == NULL)
+    if (inode == NULL) {
+        lock_release(&open_inodes_lock);
         return NULL;
+    }
 
     /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
     inode->sector = sector;
+    inode->loading = true;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
     lock_init(&inode->lock_inode);
+    inode->ra_next = 0;
+    inode->ra_end = 0;
+    lock_init(&inode->lock_extents);
+    inode->ext_sector = SECTOR_MAGIC;
+    inode->pre_start = SECTOR_MAGIC;
+    inode->pre_cnt = 0;
+    hash_insert(&open_inodes, &inode->elem);
+    lock_release(&open_inodes_lock);
+
+    /* Read the disk inode without holding up other opens. */
+    buffer_cache_read(sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
+    buffer_cache_mark_meta(sector);
+    lock_acquire(&open_inodes_lock);
+    inode->loading = false;
+    cond_broadcast(&inode_loaded, &open_inodes_lock);
+    lock_release(&open_inodes_lock);
     return inode;
 }
 
@@ -164,8 +293,11 @@ struct inode *inode_open(block_sector_t sector)
 struct inode *
 inode_reopen(struct inode *inode)
 {
-    if (inode != NULL)
+    if (inode != NULL) {
+        lock_acquire(&open_inodes_lock);
         inode->open_cnt++;
+        lock_release(&open_inodes_lock);
+    }
     return inode;
 }
 
@@ -181,28 +313,39 @@ inode_get_inumber(const struct inode *inode)
    If INODE was also a removed inode, frees its blocks. */
 void inode_close(struct inode *inode)
 {
-    struct inode_disk i;
     /* Ignore null pointer. */
     if (inode == NULL)
         return;
 
     /* Release resources if this was the last opener. */
+    lock_acquire(&open_inodes_lock);
     if (--inode->open_cnt == 0)
     {
-        /* Remove from inode list and release lock. */
-        list_remove(&inode->elem);
+        /* Remove from inode table and release lock. */
+        hash_delete(&open_inodes, &inode->elem);
+        lock_release(&open_inodes_lock);
+
+        /* Give back what growth reserved but did not use. */
+        if (inode->pre_cnt > 0)
+            free_map_release(inode->pre_start, inode->pre_cnt);
 
         /* Deallocate blocks if removed. */
         if (inode->removed)
         {
-            buffer_cache_read(inode->sector, &i, 0, BLOCK_SECTOR_SIZE, 0);
-            //free_map_release(inode->sector, 1);
-            free_sectors_inode(&i);
+            free_sectors_inode(&inode->data);
             free_map_release(inode->sector, 1);
+            if (inode_get_index(inode) != 0) {
+                struct inode* index = inode_open(inode_get_index(inode));
+                if (index != NULL)
+                    inode_remove(index);
+                inode_close(index);
+            }
         }
 
         free(inode);
     }
+    else
+        lock_release(&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -224,13 +367,19 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
     struct inode_disk i_disk;
     //synchronization needed in r/w
     lock_acquire(&inode->lock_inode);
-    //buffer_cache_read(&i_disk->sector,&i_disk,0,sizeof(struct i_disk),0);
-    buffer_cache_read(inode->sector, &i_disk, 0, sizeof(struct inode_disk), 0);
+    i_disk = inode->data;
     lock_release(&inode->lock_inode);
+    if (i_disk.inlined) {
+        if (offset < i_disk.length) {
+            bytes_read = size < i_disk.length - offset ? size : i_disk.length - offset;
+            memcpy(buffer, i_disk.data + offset, bytes_read);
+        }
+        return bytes_read;
+    }
     while (size > 0)
     {
         /* Disk sector to read, starting byte offset within sector. */
-        block_sector_t sector_idx = byte_to_sector(&i_disk, offset);
+        block_sector_t sector_idx = byte_to_sector(inode, &i_disk, offset);
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -244,48 +393,125 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
         if (chunk_size <= 0)
             break;
 
-        buffer_cache_read(sector_idx, buffer, bytes_read, chunk_size, sector_ofs);
+        if (sector_idx == SECTOR_MAGIC)
+            memset(buffer + bytes_read, 0, chunk_size);     //a hole
+        else {
+            buffer_cache_read(sector_idx, buffer, bytes_read, chunk_size, sector_ofs);
+            if (is_meta_data(inode, &i_disk))
+                buffer_cache_mark_meta(sector_idx);
+        }
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_read += chunk_size;
     }
+    read_ahead(inode, &i_disk, offset - bytes_read, offset);
     return bytes_read;
 }
 
+/* Queues read-ahead of the sectors following [START, END) if that
+   range continues the previous read of INODE, so a sequential
+   reader finds them in the cache.  lock_inode only guards the
+   detection state; the sectors are looked up after releasing it. */
+static void read_ahead(struct inode *inode, const struct inode_disk *i_disk, off_t start, off_t end)
+{
+    off_t pos, limit, stop;
+
+    if (read_ahead_window <= 0 || end <= start || i_disk->inlined)
+        return;
+    lock_acquire(&inode->lock_inode);
+    if (start != inode->ra_next) {
+        /* Random access: restart detection from here. */
+        inode->ra_next = end;
+        inode->ra_end = end;
+        lock_release(&inode->lock_inode);
+        return;
+    }
+    inode->ra_next = end;
+    pos = ROUND_UP(end > inode->ra_end ? end : inode->ra_end, BLOCK_SECTOR_SIZE);
+    limit = ROUND_UP(end, BLOCK_SECTOR_SIZE) + read_ahead_window * BLOCK_SECTOR_SIZE;
+    if (limit > i_disk->length)
+        limit = i_disk->length;
+    stop = pos < limit ? pos + ROUND_UP(limit - pos, BLOCK_SECTOR_SIZE) : pos;
+    if (stop > inode->ra_end)
+        inode->ra_end = stop;
+    lock_release(&inode->lock_inode);
+
+    for (; pos < limit; pos += BLOCK_SECTOR_SIZE) {
+        block_sector_t sec = byte_to_sector(inode, i_disk, pos);
+        if (sec != SECTOR_MAGIC)
+            buffer_cache_read_ahead(sec);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends the inode, leaving a hole
+   between the old end and OFFSET. */
 off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t offset)
 {
     const uint8_t* buffer = buffer_;
     off_t bytes_written = 0;
     uint8_t* bounce = NULL;
     struct inode_disk i_disk;
+    off_t old_length, end = offset + size;
 
     if (inode->deny_write_cnt)
         return 0;
 
     lock_acquire(&inode->lock_inode);
+    if (inode->data.inlined) {
+        if (offset + size <= INODE_INLINE_BYTES) {
+            memcpy(inode->data.data + offset, buffer, size);
+            if (inode->data.length < offset + size)
+                inode->data.length = offset + size;
+            buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
+            lock_release(&inode->lock_inode);
+            return size;
+        }
+        if (!inline_to_extents(inode)) {
+            lock_release(&inode->lock_inode);
+            return 0;
+        }
+    }
     //update_inode(&i_disk,inode_disk.length,offset+size);
     //buffer_cache_write(inode_sector,&i_disk,0,BLOCK_SECTOR_SIZE,0);
-    buffer_cache_read(inode->sector, &i_disk, 0, sizeof(struct inode_disk), 0);
-    if (i_disk.length >= offset + size) {
-        lock_release(&inode->lock_inode);
-    }
-    else {
-        update_inode(&i_disk, i_disk.length, offset + size);
-        buffer_cache_write(inode->sector, &i_disk, 0, BLOCK_SECTOR_SIZE, 0);
-        lock_release(&inode->lock_inode);
+    old_length = inode->data.length;
+    if (old_length < end) {
+        if (!grow_sparse(&inode->data, end)) {
+            lock_release(&inode->lock_inode);
+            return 0;
+        }
+        buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
     }
+    i_disk = inode->data;
+    lock_release(&inode->lock_inode);
 
 
     while (size > 0)
     {
         /* Sector to write, starting byte offset within sector. */
-        block_sector_t sector_idx = byte_to_sector(&i_disk, offset);
+        block_sector_t sector_idx = byte_to_sector(inode, &i_disk, offset);
+        if (sector_idx == SECTOR_MAGIC && offset < i_disk.length) {
+            //a hole: give it sectors for the rest of this write
+            lock_acquire(&inode->lock_inode);
+            if (fill_hole(inode, offset / BLOCK_SECTOR_SIZE,
+                    DIV_ROUND_UP(offset + size, BLOCK_SECTOR_SIZE) - offset / BLOCK_SECTOR_SIZE))
+                buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
+            i_disk = inode->data;
+            lock_release(&inode->lock_inode);
+            sector_idx = byte_to_sector(inode, &i_disk, offset);
+            if (sector_idx == SECTOR_MAGIC) {
+                //the disk is full: end the file where this write stopped
+                lock_acquire(&inode->lock_inode);
+                if (inode->data.length == end && old_length < end
+                    && trim_sparse(inode, offset > old_length ? offset : old_length))
+                    buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
+                lock_release(&inode->lock_inode);
+                break;
+            }
+        }
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -298,6 +524,8 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t
         if (chunk_size <= 0)
             break;
         buffer_cache_write(sector_idx, buffer, bytes_written, chunk_size, sector_ofs);
+        if (is_meta_data(inode, &i_disk))
+            buffer_cache_mark_meta(sector_idx);
 
         /* Advance. */
         size -= chunk_size;
@@ -329,180 +557,428 @@ void inode_allow_write(struct inode *inode)
 
 bool is_direc(struct inode* i) {
     if (i->removed) return false;
-    bool success = false;
-    struct inode_disk* i_d = (struct inode_disk*)malloc(BLOCK_SECTOR_SIZE);
-    buffer_cache_read(i->sector, i_d, 0, BLOCK_SECTOR_SIZE, 0);
-    if (i_d->isdir) success = true;
-    free(i_d);
-    return success;
+    return i->data.isdir;
+}
+
+/* Returns the sector of the index inode of directory INODE, or 0 if
+   it has none. */
+block_sector_t inode_get_index(struct inode* inode)
+{
+    if (!inode->data.isdir || inode->data.inlined)
+        return 0;
+    return inode->data.index;
+}
+
+/* Records INDEX as the index inode of directory INODE, which is too
+   big to be inline. */
+void inode_set_index(struct inode* inode, block_sector_t index)
+{
+    lock_acquire(&inode->lock_inode);
+    ASSERT(inode->data.isdir && !inode->data.inlined);
+    inode->data.index = index;
+    buffer_cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE, 0);
+    lock_release(&inode->lock_inode);
 }
 
-void set_sector_index(off_t p, struct sector_index *sec_idx)
+/* Returns true if START, a disk sector or SECTOR_MAGIC for a hole,
+   continues extent E. */
+static bool contiguous(const struct extent* e, block_sector_t start)
 {
-    p = p / BLOCK_SECTOR_SIZE;
+    if (start == SECTOR_MAGIC || e->start == SECTOR_MAGIC)
+        return start == e->start;
+    return e->start + e->length == start;
+}
 
-    if (p < 123) {
-        sec_idx->kind = 0;
-        sec_idx->idx1 = p;
+/* Appends the CNT sectors starting at START, or a hole of CNT
+   sectors if START is SECTOR_MAGIC, to the end of the
+   mapping of I, growing its last extent if START continues it and
+   chaining a new extent block if the last one is full.  Returns
+   false if that block cannot be allocated. */
+bool add_extent(struct inode_disk* i, block_sector_t start, size_t cnt)
+{
+    struct buffer_cache_entry* e = NULL;
+    struct extent* ext = i->extents;
+    uint32_t* ext_cnt = &i->extent_cnt;
+    block_sector_t* next = &i->extent_next;
+    uint32_t max = INODE_EXTENTS;
+    block_sector_t sec;
+
+    //find the last list of extents
+    while ((sec = *next) != SECTOR_MAGIC) {
+        if (e) buffer_cache_put(e, false);
+        e = get_meta(sec);
+        struct extent_block* b = (struct extent_block*)e->buffer;
+        ext = b->extents;
+        ext_cnt = &b->extent_cnt;
+        next = &b->next;
+        max = EXTENT_BLOCK_EXTENTS;
     }
-    else if (123 <= p && p < 251) {
-        p = p - 123;
-        sec_idx->kind = 1;
-        sec_idx->idx1 = p;
+
+    if (*ext_cnt > 0 && contiguous(&ext[*ext_cnt - 1], start)) {
+        ext[*ext_cnt - 1].length += cnt;
     }
-    else if (251 <= p && p < (1 << 14) + 251) {
-        p = p - 251;
-        sec_idx->kind = 2;
-        sec_idx->idx1 = p / (1 << 7);
-        sec_idx->idx2 = p % (1 << 7);
+    else {
+        if (*ext_cnt == max) {
+            struct buffer_cache_entry* n;
+            struct extent_block* b;
+            if (!free_map_allocate(1, &sec)) {
+                if (e) buffer_cache_put(e, false);
+                return false;
+            }
+            n = buffer_cache_get_new(sec);
+            buffer_cache_mark_meta(sec);
+            b = (struct extent_block*)n->buffer;
+            b->extent_cnt = 0;
+            b->next = SECTOR_MAGIC;
+            *next = sec;
+            if (e) buffer_cache_put(e, true);
+            e = n;
+            ext = b->extents;
+            ext_cnt = &b->extent_cnt;
+        }
+        ext[*ext_cnt].start = start;
+        ext[*ext_cnt].length = cnt;
+        (*ext_cnt)++;
     }
-    else
-        sec_idx->kind = -1;
+    if (e) buffer_cache_put(e, true);
+    return true;
 }
 
-void init_sector_indirect(struct indirect_inode *insec){
-    for (int i = 0; i < (1 << 7); i++)
-        insec->table[i] = SECTOR_MAGIC;
+/* Returns the sector following the last one I_D maps, or 0 if its
+   last extent list maps none. */
+static block_sector_t mapping_end(const struct inode_disk* i_d)
+{
+    struct buffer_cache_entry* e = NULL;
+    const struct extent* ext = i_d->extents;
+    uint32_t cnt = i_d->extent_cnt;
+    block_sector_t sec = i_d->extent_next;
+    block_sector_t end;
+
+    while (sec != SECTOR_MAGIC) {
+        if (e) buffer_cache_put(e, false);
+        e = get_meta(sec);
+        const struct extent_block* b = (const struct extent_block*)e->buffer;
+        ext = b->extents;
+        cnt = b->extent_cnt;
+        sec = b->next;
+    }
+    for (end = 0; cnt > 0 && end == 0; cnt--)
+        if (ext[cnt - 1].start != SECTOR_MAGIC)
+            end = ext[cnt - 1].start + ext[cnt - 1].length;
+    if (e) buffer_cache_put(e, false);
+    return end;
 }
 
-bool add_new_sector(struct inode_disk *i, block_sector_t new, struct sector_index sec_idx)
+/* Returns where new sectors for INODE, whose on-disk inode is I_D,
+   should go: after its window or its last block, or next to the
+   inode itself in the same block group if it has no blocks yet. */
+static block_sector_t allocation_hint(const struct inode* inode, const struct inode_disk* i_d)
 {
+    block_sector_t end;
+
+    if (inode->pre_start != SECTOR_MAGIC)
+        return inode->pre_start;
+    end = mapping_end(i_d);
+    return end != 0 ? end : inode->sector;
+}
 
-    if (sec_idx.kind == 0) {
-        i->table_direct[sec_idx.idx1] = new;
-        return true;
+/* Finds up to CNT sectors to append to I_D, the inode at SECTOR,
+   and stores the first in *START, returning how many it found or 0
+   if the disk is full.  With an open INODE they come from its
+   preallocation window, which is refilled with PREALLOC_SECTORS
+   more than needed right after the file's last block, so files
+   growing side by side do not interleave.  Otherwise they go near
+   SECTOR. */
+static size_t allocate_run(struct inode* inode, block_sector_t sector, const struct inode_disk* i_d,
+                           size_t cnt, block_sector_t* start)
+{
+    block_sector_t hint;
+    size_t total;
+
+    if (inode == NULL || inode->pre_cnt == 0) {
+        hint = inode != NULL ? allocation_hint(inode, i_d) : sector;
+        total = inode != NULL ? cnt + PREALLOC_SECTORS : cnt;
+
+        //take the longest free run there is, down to one sector
+        while (!free_map_allocate_near(total, hint, start))
+            if ((total /= 2) == 0)
+                return 0;
+        if (inode == NULL || total <= cnt)
+            return total;
+        inode->pre_start = *start;
+        inode->pre_cnt = total;
     }
+    if (cnt > inode->pre_cnt)
+        cnt = inode->pre_cnt;
+    *start = inode->pre_start;
+    inode->pre_start += cnt;
+    inode->pre_cnt -= cnt;
+    return cnt;
+}
 
-    struct indirect_inode s, d;
-    block_sector_t* tmp;
+/* Grows I_D, the inode at SECTOR, which is S bytes long, to E
+   bytes, mapping and zeroing the sectors it needs.  Each run of new
+   sectors is allocated in one piece if the free map has room, so a
+   file written in one go gets one extent.  INODE, if not null, is
+   the open inode I_D belongs to, whose preallocation window is
+   used.  Returns false, with the length cut to what could be
+   mapped, if the disk is full. */
+bool update_inode(struct inode* inode, block_sector_t sector, struct inode_disk* i_d, off_t s, off_t e) {
+    size_t have = DIV_ROUND_UP(s, BLOCK_SECTOR_SIZE);
+    size_t want = DIV_ROUND_UP(e, BLOCK_SECTOR_SIZE);
 
-    if (sec_idx.kind == 1) {
-        tmp = &i->sector_indirect;
-        if (*tmp != SECTOR_MAGIC)
-            buffer_cache_read(*tmp, &d, 0, sizeof(struct indirect_inode), 0);
-        else {
-            if (free_map_allocate(1, tmp)) init_sector_indirect(&d);
-            else return false;
-        }
-        if (d.table[sec_idx.idx1] == SECTOR_MAGIC)
-            d.table[sec_idx.idx1] = new;
-        buffer_cache_write(*tmp, &d, 0, sizeof(struct indirect_inode), 0);
-        return true;
-    }
-    else if (sec_idx.kind == 2) {
-        tmp = &i->sector_double_indirect;
-        if (*tmp != SECTOR_MAGIC)
-            buffer_cache_read(*tmp, &s, 0, sizeof(struct indirect_inode), 0);
-        else {
-            if (free_map_allocate(1, tmp)) init_sector_indirect(&s);
-            else return false;
-        }
-        tmp = &s.table[sec_idx.idx1];
-        if (*tmp != SECTOR_MAGIC) {
-            buffer_cache_read(*tmp, &d, 0, sizeof(struct indirect_inode), 0);
-            if (d.table[sec_idx.idx2] == SECTOR_MAGIC) {
-                d.table[sec_idx.idx2] = new;
-            }
-            buffer_cache_write(*tmp, &d, 0, sizeof(struct indirect_inode), 0);
-        }
-        else {
-            if (free_map_allocate(1, tmp)) {
-                init_sector_indirect(&d);
-                if (d.table[sec_idx.idx2] == SECTOR_MAGIC)
-                    d.table[sec_idx.idx2] = new;
-                buffer_cache_write(i->sector_double_indirect, &s, 0, sizeof(struct indirect_inode), 0);
-                buffer_cache_write(*tmp, &d, 0, sizeof(struct indirect_inode), 0);
-            }
-            else return false;
+    i_d->length = e;
+    while (have < want) {
+        block_sector_t start;
+        size_t cnt = allocate_run(inode, sector, i_d, want - have, &start);
+
+        if (cnt == 0 || !add_extent(i_d, start, cnt)) {
+            if (cnt != 0)
+                free_map_release(start, cnt);
+            if ((off_t)(have * BLOCK_SECTOR_SIZE) < i_d->length)
+                i_d->length = have * BLOCK_SECTOR_SIZE;
+            return false;
         }
-        return true;
+        for (size_t k = 0; k < cnt; k++)
+            buffer_cache_put(buffer_cache_get_new(start + k), true);
+        have += cnt;
     }
-    return false;
+    return true;
 }
 
-bool update_inode(struct inode_disk* i_d, off_t s, off_t e) {
-    block_sector_t tmp;
-    struct sector_index sec_idx;
-    static char temp[BLOCK_SECTOR_SIZE];
+/* Grows I_D to E bytes, leaving the new sectors as a hole, which
+   the write that grows it gives disk sectors with fill_hole() as it
+   reaches them.  Returns false, changing nothing, if an extent
+   block is needed and cannot be allocated. */
+static bool grow_sparse(struct inode_disk* i_d, off_t e)
+{
+    size_t have = DIV_ROUND_UP(i_d->length, BLOCK_SECTOR_SIZE);
+    size_t want = DIV_ROUND_UP(e, BLOCK_SECTOR_SIZE);
 
+    if (have < want && !add_extent(i_d, SECTOR_MAGIC, want - have))
+        return false;
     i_d->length = e;
-    s /= BLOCK_SECTOR_SIZE;
-    s *= BLOCK_SECTOR_SIZE;
-    e -= 1;
-    e /= BLOCK_SECTOR_SIZE;
-    e *= BLOCK_SECTOR_SIZE;
-
-    while (s <= e) {
-        tmp = byte_to_sector(i_d, s);
-        if (tmp == SECTOR_MAGIC) {
-            if (free_map_allocate(1, &tmp)) {
-                set_sector_index(s, &sec_idx);
-                if (!add_new_sector(i_d, tmp, sec_idx)) return false;
-                buffer_cache_write(tmp, temp, 0, BLOCK_SECTOR_SIZE, 0);
-                s += BLOCK_SECTOR_SIZE;
-            }
-            else return false;
+    return true;
+}
+
+/* Cuts INODE back to E bytes after a write that grew it with
+   grow_sparse() could not fill its holes, unmapping the trailing
+   hole sectors it no longer needs.  Called with lock_inode held.
+   Returns false, changing nothing, if those sectors are not all
+   holes at the end of the last extent list. */
+static bool trim_sparse(struct inode* inode, off_t e)
+{
+    struct inode_disk* i = &inode->data;
+    struct buffer_cache_entry* b_e = NULL;
+    struct extent* ext = i->extents;
+    uint32_t* ext_cnt = &i->extent_cnt;
+    block_sector_t sec = i->extent_next;
+    size_t excess = DIV_ROUND_UP(i->length, BLOCK_SECTOR_SIZE) - DIV_ROUND_UP(e, BLOCK_SECTOR_SIZE);
+    size_t holes = 0;
+    uint32_t k;
+    bool ok;
+
+    lock_acquire(&inode->lock_extents);
+    while (sec != SECTOR_MAGIC) {
+        if (b_e) buffer_cache_put(b_e, false);
+        b_e = get_meta(sec);
+        struct extent_block* b = (struct extent_block*)b_e->buffer;
+        ext = b->extents;
+        ext_cnt = &b->extent_cnt;
+        sec = b->next;
+    }
+    for (k = *ext_cnt; k > 0 && holes < excess && ext[k - 1].start == SECTOR_MAGIC; k--)
+        holes += ext[k - 1].length;
+    ok = holes >= excess;
+    if (ok) {
+        while (excess > 0) {
+            struct extent* last = &ext[*ext_cnt - 1];
+            size_t n = last->length < excess ? last->length : excess;
+            last->length -= n;
+            excess -= n;
+            if (last->length == 0)
+                (*ext_cnt)--;
         }
-        else
-            s += BLOCK_SECTOR_SIZE;
+        inode->ext_sector = SECTOR_MAGIC;
+        i->length = e;
     }
+    if (b_e) buffer_cache_put(b_e, ok);
+    lock_release(&inode->lock_extents);
+    return ok;
+}
+
+/* Replaces extent K of the CNT extents EXT, a list that holds at
+   most MAX and is followed by the extent block NEXT, with the N
+   extents PIECE.  If they do not fit, the extents after K, and
+   what does not fit of PIECE, move to a new extent block chained
+   after this list.  Returns false, changing nothing, if that block
+   cannot be allocated. */
+static bool replace_extent(struct extent* ext, uint32_t* cnt, block_sector_t* next, uint32_t max,
+    uint32_t k, const struct extent* piece, size_t n)
+{
+    uint32_t t = *cnt - k - 1;      //extents after K
+
+    if (*cnt + n - 1 > max) {
+        struct buffer_cache_entry* e;
+        struct extent_block* b;
+        block_sector_t sec;
+        size_t spill = k + n > max ? k + n - max : 0;
+
+        if (!free_map_allocate(1, &sec))
+            return false;
+        e = buffer_cache_get_new(sec);
+        buffer_cache_mark_meta(sec);
+        b = (struct extent_block*)e->buffer;
+        memcpy(b->extents, piece + n - spill, spill * sizeof *piece);
+        memcpy(b->extents + spill, ext + k + 1, t * sizeof *ext);
+        b->extent_cnt = spill + t;
+        b->next = *next;
+        *next = sec;
+        buffer_cache_put(e, true);
+        n -= spill;
+        t = 0;
+    }
+    memmove(ext + k + n, ext + k + 1, t * sizeof *ext);
+    memcpy(ext + k, piece, n * sizeof *piece);
+    *cnt = k + n + t;
     return true;
 }
 
-void free_sectors_inode(struct inode_disk *i_d)
+/* Gives disk sectors to the hole of INODE that holds file sector
+   IDX, for as much of the CNT sectors from IDX as it covers,
+   splitting the hole around them.  Called with lock_inode held.
+   Returns true if the resident inode changed and must be written
+   back. */
+static bool fill_hole(struct inode* inode, size_t idx, size_t cnt)
 {
-    struct indirect_inode* insec1, * insec2;
-    int i, j;
-
-    //second indirection
-    if (i_d->sector_double_indirect != SECTOR_MAGIC) {
-        i = 0;
-        insec1 = (struct indirect_inode*)malloc(BLOCK_SECTOR_SIZE);
-        buffer_cache_read(i_d->sector_double_indirect, insec1, 0, sizeof(struct indirect_inode), 0);
-        while (insec1->table[i] != SECTOR_MAGIC) {
-            j = 0;
-            insec2 = (struct indirect_inode*)malloc(BLOCK_SECTOR_SIZE);
-            buffer_cache_read(insec2->table[j], insec2, 0, sizeof(struct indirect_inode), 0);
-            while (insec2->table[j] != SECTOR_MAGIC) {
-                free_map_release(insec2->table[j], 1);
-                j++;
-            }
-            free_map_release(insec1->table[i], 1);
-            free(insec2);
-            i++;
-        }
-        free(insec1);
-        return;
+    struct inode_disk* i = &inode->data;
+    struct buffer_cache_entry* e = NULL;
+    struct extent* ext = i->extents;
+    uint32_t* ext_cnt = &i->extent_cnt;
+    block_sector_t* next = &i->extent_next;
+    uint32_t max = INODE_EXTENTS;
+    struct extent piece[3];
+    size_t n = 0, rest;
+    block_sector_t start;
+    uint32_t k;
+    bool merge, changed = false;
+
+    //settle where allocation looks before holding any extent block
+    inode->pre_start = allocation_hint(inode, i);
+
+    lock_acquire(&inode->lock_extents);
+    //find the extent that holds IDX
+    for (;;) {
+        for (k = 0; k < *ext_cnt && idx >= ext[k].length; k++)
+            idx -= ext[k].length;
+        block_sector_t sec = *next;
+        if (k < *ext_cnt || sec == SECTOR_MAGIC)
+            break;
+        if (e) buffer_cache_put(e, false);
+        e = get_meta(sec);
+        struct extent_block* b = (struct extent_block*)e->buffer;
+        ext = b->extents;
+        ext_cnt = &b->extent_cnt;
+        next = &b->next;
+        max = EXTENT_BLOCK_EXTENTS;
+    }
+    if (k == *ext_cnt || ext[k].start != SECTOR_MAGIC)
+        goto done;
+
+    if (cnt > ext[k].length - idx)
+        cnt = ext[k].length - idx;
+    cnt = allocate_run(inode, inode->sector, i, cnt, &start);
+    if (cnt == 0)
+        goto done;
+    rest = ext[k].length - idx - cnt;
+
+    if (idx > 0) {
+        piece[n].start = SECTOR_MAGIC;
+        piece[n++].length = idx;
     }
+    merge = idx == 0 && k > 0 && contiguous(&ext[k - 1], start);
+    if (!merge) {
+        piece[n].start = start;
+        piece[n++].length = cnt;
+    }
+    if (rest > 0) {
+        piece[n].start = SECTOR_MAGIC;
+        piece[n++].length = rest;
+    }
+    if (!replace_extent(ext, ext_cnt, next, max, k, piece, n)) {
+        free_map_release(start, cnt);
+        goto done;
+    }
+    if (merge)
+        ext[k - 1].length += cnt;
+    for (size_t j = 0; j < cnt; j++)
+        buffer_cache_put(buffer_cache_get_new(start + j), true);
+    inode->ext_sector = SECTOR_MAGIC;
+    changed = true;
+
+done:
+    if (e) buffer_cache_put(e, changed);
+    lock_release(&inode->lock_extents);
+    return changed;
+}
 
-    //first indirection
-    if (i_d->sector_indirect != SECTOR_MAGIC) {
-        i = 0;
-        insec1 = (struct indirect_inode*)malloc(BLOCK_SECTOR_SIZE);
-        buffer_cache_read(i_d->sector_indirect, insec1, 0, sizeof(struct indirect_inode), 0);
-        while (insec1->table[i] != SECTOR_MAGIC) {
-            free_map_release(insec1->table[i], 1);
-            i++;
-        }
-        free(insec1);
-        return;
+/* Moves the contents of INODE out of its inode sector into a data
+   sector of their own, so that the file can grow past
+   INODE_INLINE_BYTES.  Called with lock_inode held.  Returns false
+   if memory or the disk is short. */
+static bool inline_to_extents(struct inode* inode)
+{
+    struct inode_disk* i = &inode->data;
+    off_t length = i->length;
+    uint8_t* data = malloc(INODE_INLINE_BYTES);
+
+    if (data == NULL)
+        return false;
+    memcpy(data, i->data, INODE_INLINE_BYTES);
+    memset(i->data, 0, INODE_INLINE_BYTES);
+    i->inlined = false;
+    i->extent_next = SECTOR_MAGIC;
+    if (!update_inode(inode, inode->sector, i, 0, length)) {
+        free_sectors_inode(i);
+        memcpy(i->data, data, INODE_INLINE_BYTES);
+        i->inlined = true;
+        i->length = length;
+        free(data);
+        return false;
     }
+    if (length > 0)
+        buffer_cache_write(i->extents[0].start, data, 0, length, 0);
+    free(data);
+    return true;
+}
 
-    i = 0;
-    //direct
-    while (i_d->table_direct[i] != SECTOR_MAGIC) {
-        free_map_release(i_d->table_direct[i], 1);
-        i++;
+/* Releases the extents of I_D and the extent blocks that hold
+   them.  The blocks are read in place from the buffer cache. */
+void free_sectors_inode(struct inode_disk *i_d)
+{
+    struct buffer_cache_entry* e;
+    block_sector_t sec, next;
+    uint32_t k;
+
+    if (i_d->inlined)
+        return;
+    for (k = 0; k < i_d->extent_cnt; k++)
+        if (i_d->extents[k].start != SECTOR_MAGIC)
+            free_map_release(i_d->extents[k].start, i_d->extents[k].length);
+
+    for (sec = i_d->extent_next; sec != SECTOR_MAGIC; sec = next) {
+        e = buffer_cache_get(sec);
+        struct extent_block* b = (struct extent_block*)e->buffer;
+        for (k = 0; k < b->extent_cnt; k++)
+            if (b->extents[k].start != SECTOR_MAGIC)
+                free_map_release(b->extents[k].start, b->extents[k].length);
+        next = b->next;
+        buffer_cache_put(e, false);
+        free_map_release(sec, 1);
     }
-    return;
 }
 
 off_t inode_length(struct inode *inode)
 {
-    off_t res;
-    struct inode_disk *disk_inode = (struct inode_disk *)malloc(BLOCK_SECTOR_SIZE);
-    buffer_cache_read(inode->sector, disk_inode, 0, BLOCK_SECTOR_SIZE, 0);
-    res = disk_inode->length;
-    free(disk_inode);
-    return res;
+    return inode->data.length;
 }
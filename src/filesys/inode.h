@@ -7,25 +7,46 @@
 
 struct bitmap;
 
-struct sector_index {
-	int kind;
-	int idx1;
-	int idx2;
+/* LENGTH consecutive disk sectors starting at START, which map
+   the next LENGTH sectors of a file. */
+struct extent {
+	block_sector_t start;
+	uint32_t length;
 };
-struct indirect_inode {
-	block_sector_t table[1 << 7];
+
+#define INODE_EXTENTS 61        /* Extents held in the inode itself. */
+#define EXTENT_BLOCK_EXTENTS 63 /* Extents per overflow block. */
+#define PREALLOC_SECTORS 16     /* Sectors an open file reserves past its end. */
+#define INODE_INLINE_BYTES 500  /* Largest file kept in its inode sector. */
+
+/* Overflow extents of a file with more than INODE_EXTENTS,
+   chained from inode_disk.extent_next in file order. */
+struct extent_block {
+	uint32_t extent_cnt;            /* Extents in use. */
+	block_sector_t next;            /* Next block, or SECTOR_MAGIC. */
+	struct extent extents[EXTENT_BLOCK_EXTENTS];
 };
 
+/* A small file keeps its contents in DATA instead of mapping
+   sectors, until it grows past INODE_INLINE_BYTES. */
 struct inode_disk {
 	off_t length;
 	unsigned magic;
 	bool isdir;
-	block_sector_t table_direct[123];
-	block_sector_t sector_indirect;
-	block_sector_t sector_double_indirect;
+	bool inlined;                   /* Contents are in DATA. */
+	union {
+		struct {
+			uint32_t extent_cnt;            /* Extents in use in EXTENTS. */
+			block_sector_t extent_next;     /* First extent block, or SECTOR_MAGIC. */
+			struct extent extents[INODE_EXTENTS];
+			block_sector_t index;           /* A directory's index inode, or 0. */
+		};
+		uint8_t data[INODE_INLINE_BYTES];
+	};
 };
 
 void inode_init(void);
+void inode_done(void);
 bool inode_create(block_sector_t, off_t, bool);
 struct inode *inode_open(block_sector_t);
 struct inode *inode_reopen(struct inode *);
@@ -38,11 +59,11 @@ void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(struct inode *);
 bool is_direc(struct inode*);
+block_sector_t inode_get_index(struct inode*);
+void inode_set_index(struct inode*, block_sector_t);
 
-void set_sector_index(off_t, struct sector_index*);
-void init_sector_indirect(struct indirect_inode* block);
-bool add_new_sector(struct inode_disk*, block_sector_t, struct sector_index);
+bool add_extent(struct inode_disk*, block_sector_t, size_t);
 void free_sectors_inode(struct inode_disk*);
-bool update_inode(struct inode_disk*, off_t, off_t);
+bool update_inode(struct inode*, block_sector_t, struct inode_disk*, off_t, off_t);
 
 #endif /* filesys/inode.h */
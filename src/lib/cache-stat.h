@@ -0,0 +1,19 @@
+#ifndef __LIB_CACHE_STAT_H
+#define __LIB_CACHE_STAT_H
+
+/* Buffer cache counters, as reported by the cache_stat() system
+   call and printed at shutdown. */
+struct cache_stat
+  {
+    unsigned size;                      /* Cache size in sectors. */
+    unsigned long long hits;            /* Accesses found in the cache. */
+    unsigned long long misses;          /* Accesses that had to fill an entry. */
+    unsigned long long evictions;       /* Valid entries recycled for a miss. */
+    unsigned long long writebacks;      /* Dirty sectors written to disk. */
+    unsigned long long read_aheads;     /* Sectors filled by read-ahead. */
+    unsigned long long read_ahead_hits; /* First hits on read-ahead sectors. */
+    unsigned long long lookups;         /* Index probes. */
+    unsigned long long probes;          /* Hash chain entries examined. */
+  };
+
+#endif /* lib/cache-stat.h */
@@ -69,6 +69,30 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns the index of the first bit in B at or after START, and
+   before END, that is set to VALUE, or END if there is none.
+   Elements holding no such bit are skipped whole. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t i = start;
+
+  while (i < end)
+    {
+      size_t base = i - i % ELEM_BITS;
+      elem_type e = value ? b->bits[elem_idx (i)] : ~b->bits[elem_idx (i)];
+
+      e &= (elem_type) -1 << (i % ELEM_BITS);
+      if (e != 0)
+        {
+          i = base + __builtin_ctzl (e);
+          return i < end ? i : end;
+        }
+      i = base + ELEM_BITS;
+    }
+  return end;
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -250,16 +274,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -296,15 +315,42 @@ size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
-  ASSERT (start <= b->bit_cnt);
+  return bitmap_scan_range (b, start, b->bit_cnt, cnt, value);
+}
 
-  if (cnt <= b->bit_cnt) 
+/* Like bitmap_scan(), but only finds a group that starts before
+   END, though it may extend past it. */
+size_t
+bitmap_scan_range (const struct bitmap *b, size_t start, size_t end,
+                   size_t cnt, bool value) 
+{
+  ASSERT (b != NULL);
+  ASSERT (start <= end);
+  ASSERT (end <= b->bit_cnt);
+
+  if (cnt == 0)
+    return start;
+  if (cnt <= b->bit_cnt && start < end) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (last > end - 1)
+        last = end - 1;
+
+      /* Jump from each candidate run to the bit that ends it. */
+      for (;;)
+        {
+          size_t stop;
+
+          i = find_bit (b, i, last + 1, value);
+          if (i > last)
+            break;
+          stop = find_bit (b, i, i + cnt, !value);
+          if (stop == i + cnt)
+            return i;
+          i = stop;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +404,23 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold the CNT bits starting at START
+   to the same place in FILE, which must already hold the rest of
+   B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start <= b->bit_cnt);
+  if (cnt > b->bit_cnt - start)
+    cnt = b->bit_cnt - start;
+  ofs = start / CHAR_BIT;
+  size = DIV_ROUND_UP (start + cnt, CHAR_BIT) - ofs;
+  return file_write_at (file, (const char *) b->bits + ofs, size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
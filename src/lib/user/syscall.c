@@ -207,3 +207,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+cache_stat (struct cache_stat *st)
+{
+  return syscall1 (SYS_CACHE_STAT, st);
+}
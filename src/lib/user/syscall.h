@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <debug.h>
+#include <cache-stat.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -46,5 +47,6 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool cache_stat (struct cache_stat *);
 
 #endif /* lib/user/syscall.h */
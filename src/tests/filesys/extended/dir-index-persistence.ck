@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($fs);
+$fs->{'x'}{"file$_"} = [''] foreach grep ($_ % 2, 0...199);
+$fs->{'x'}{'new'} = [''];
+check_archive ($fs);
+pass;
@@ -0,0 +1,96 @@
+/* Creates enough files in a directory for it to be indexed,
+   then looks them all up, removes every other one, and checks
+   that lookups, readdir and a new file agree with what is left. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  char file_name[32];
+  bool seen[FILE_CNT + 1];
+  int fd, i, cnt;
+
+  CHECK (mkdir ("/x"), "mkdir \"/x\"");
+
+  msg ("creating /x/file0 through /x/file%d...", FILE_CNT - 1);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("opening each file...");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  msg ("removing even-numbered files...");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("checking which files remain...");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      fd = open (file_name);
+      if (i % 2 == 0 && fd != -1)
+        fail ("open \"%s\" should have failed", file_name);
+      if (i % 2 != 0 && fd < 2)
+        fail ("open \"%s\" failed", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  CHECK (create ("/x/new", 0), "create \"/x/new\"");
+  CHECK ((fd = open ("/x/new")) > 1, "open \"/x/new\"");
+  close (fd);
+
+  memset (seen, 0, sizeof seen);
+  CHECK ((fd = open ("/x")) > 1, "open \"/x\"");
+  msg ("readdir \"/x\"");
+  cnt = 0;
+  while (readdir (fd, name))
+    {
+      if (!strcmp (name, "new"))
+        i = FILE_CNT;
+      else
+        {
+          i = memcmp (name, "file", 4) ? -1 : atoi (name + 4);
+          snprintf (file_name, sizeof file_name, "file%d", i);
+          if (i < 0 || i >= FILE_CNT || strcmp (name, file_name))
+            fail ("readdir returned unexpected name \"%s\"", name);
+          if (i % 2 == 0)
+            fail ("readdir returned removed file \"%s\"", name);
+        }
+      if (seen[i])
+        fail ("readdir returned \"%s\" twice", name);
+      seen[i] = true;
+      cnt++;
+    }
+  msg ("close \"/x\"");
+  close (fd);
+  if (cnt != FILE_CNT / 2 + 1)
+    fail ("readdir returned %d names, expected %d", cnt, FILE_CNT / 2 + 1);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-index) begin
+(dir-index) mkdir "/x"
+(dir-index) creating /x/file0 through /x/file199...
+(dir-index) opening each file...
+(dir-index) removing even-numbered files...
+(dir-index) checking which files remain...
+(dir-index) create "/x/new"
+(dir-index) open "/x/new"
+(dir-index) open "/x"
+(dir-index) readdir "/x"
+(dir-index) close "/x"
+(dir-index) end
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Removes a directory and creates one of the same name elsewhere,
+   which may reuse the removed one's inode sector, then checks that
+   lookups in the new directory do not find what the old one held. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int
+get_inumber (const char *name) 
+{
+  int fd, inum;
+
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  inum = inumber (fd);
+  close (fd);
+  return inum;
+}
+
+void
+test_main (void) 
+{
+  int fd, child, parent;
+
+  CHECK (mkdir ("/p"), "mkdir \"/p\"");
+  CHECK (mkdir ("/q"), "mkdir \"/q\"");
+  CHECK (mkdir ("/p/d"), "mkdir \"/p/d\"");
+  CHECK (create ("/p/d/f", 0), "create \"/p/d/f\"");
+  CHECK ((fd = open ("/p/d/f")) > 1, "open \"/p/d/f\"");
+  msg ("close \"/p/d/f\"");
+  close (fd);
+  child = get_inumber ("/p/d/..");
+  parent = get_inumber ("/p");
+  CHECK (child == parent, "\"/p/d/..\" must be \"/p\"");
+  CHECK (remove ("/p/d/f"), "remove \"/p/d/f\"");
+  CHECK (remove ("/p/d"), "remove \"/p/d\"");
+
+  CHECK (mkdir ("/q/d"), "mkdir \"/q/d\"");
+  CHECK (open ("/q/d/f") == -1, "open \"/q/d/f\" (must return -1)");
+  child = get_inumber ("/q/d/..");
+  parent = get_inumber ("/q");
+  CHECK (child == parent, "\"/q/d/..\" must be \"/q\"");
+
+  CHECK (mkdir ("/p/d"), "mkdir \"/p/d\"");
+  CHECK (open ("/p/d/f") == -1, "open \"/p/d/f\" (must return -1)");
+  child = get_inumber ("/p/d/..");
+  parent = get_inumber ("/p");
+  CHECK (child == parent, "\"/p/d/..\" must be \"/p\"");
+}
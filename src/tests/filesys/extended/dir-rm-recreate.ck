@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-rm-recreate) begin
+(dir-rm-recreate) mkdir "/p"
+(dir-rm-recreate) mkdir "/q"
+(dir-rm-recreate) mkdir "/p/d"
+(dir-rm-recreate) create "/p/d/f"
+(dir-rm-recreate) open "/p/d/f"
+(dir-rm-recreate) close "/p/d/f"
+(dir-rm-recreate) open "/p/d/.."
+(dir-rm-recreate) open "/p"
+(dir-rm-recreate) "/p/d/.." must be "/p"
+(dir-rm-recreate) remove "/p/d/f"
+(dir-rm-recreate) remove "/p/d"
+(dir-rm-recreate) mkdir "/q/d"
+(dir-rm-recreate) open "/q/d/f" (must return -1)
+(dir-rm-recreate) open "/q/d/.."
+(dir-rm-recreate) open "/q"
+(dir-rm-recreate) "/q/d/.." must be "/q"
+(dir-rm-recreate) mkdir "/p/d"
+(dir-rm-recreate) open "/p/d/f" (must return -1)
+(dir-rm-recreate) open "/p/d/.."
+(dir-rm-recreate) open "/p"
+(dir-rm-recreate) "/p/d/.." must be "/p"
+(dir-rm-recreate) end
+EOF
+pass;
@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($tail) = random_bytes (1000);
+my ($fill) = random_bytes (5000);
+check_archive ({"testfile" => ["\0" x 20000 . $fill . "\0" x 35000 . $tail]});
+pass;
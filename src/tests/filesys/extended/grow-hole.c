@@ -0,0 +1,48 @@
+/* Writes far past the end of a file, checks that the hole left
+   before the data reads as zeros, then writes into the middle of
+   the hole and checks the whole file. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOLE_SIZE 60000
+#define TAIL_SIZE 1000
+#define FILL_OFS 20000
+#define FILL_SIZE 5000
+
+static char buf[HOLE_SIZE + TAIL_SIZE];
+static char hole[HOLE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  random_bytes (buf + HOLE_SIZE, TAIL_SIZE);
+  msg ("seek \"%s\" to %d", file_name, HOLE_SIZE);
+  seek (fd, HOLE_SIZE);
+  CHECK (write (fd, buf + HOLE_SIZE, TAIL_SIZE) == TAIL_SIZE,
+         "write %d bytes to \"%s\"", TAIL_SIZE, file_name);
+
+  msg ("seek \"%s\" to 0", file_name);
+  seek (fd, 0);
+  CHECK (read (fd, hole, HOLE_SIZE) == HOLE_SIZE,
+         "read %d bytes from \"%s\"", HOLE_SIZE, file_name);
+  compare_bytes (hole, buf, HOLE_SIZE, 0, file_name);
+
+  random_bytes (buf + FILL_OFS, FILL_SIZE);
+  msg ("seek \"%s\" to %d", file_name, FILL_OFS);
+  seek (fd, FILL_OFS);
+  CHECK (write (fd, buf + FILL_OFS, FILL_SIZE) == FILL_SIZE,
+         "write %d bytes to \"%s\"", FILL_SIZE, file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
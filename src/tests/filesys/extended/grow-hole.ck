@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-hole) begin
+(grow-hole) create "testfile"
+(grow-hole) open "testfile"
+(grow-hole) seek "testfile" to 60000
+(grow-hole) write 1000 bytes to "testfile"
+(grow-hole) seek "testfile" to 0
+(grow-hole) read 60000 bytes from "testfile"
+(grow-hole) seek "testfile" to 20000
+(grow-hole) write 5000 bytes to "testfile"
+(grow-hole) close "testfile"
+(grow-hole) open "testfile" for verification
+(grow-hole) verified contents of "testfile"
+(grow-hole) close "testfile"
+(grow-hole) end
+EOF
+pass;
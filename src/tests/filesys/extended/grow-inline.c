@@ -0,0 +1,27 @@
+/* Grows a file whose contents start out stored in its inode with
+   a write that crosses the end of that space, then keeps growing
+   it and checks the whole file. */
+
+#include <syscall.h>
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1550];
+
+static size_t
+return_block_size (void) 
+{
+  /* The third write runs from byte 450 to byte 550. */
+  static const size_t sizes[] = {300, 150, 100, 1000};
+  static size_t i;
+  return sizes[i++ % (sizeof sizes / sizeof *sizes)];
+}
+
+void
+test_main (void) 
+{
+  seq_test ("testfile",
+            buf, sizeof buf, 0,
+            return_block_size, NULL);
+}
@@ -34,6 +34,10 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -49,6 +53,8 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+static char *stripe_bdev_names;
+static size_t ramdisk_sectors;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -122,6 +128,11 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  if (ramdisk_sectors > 0)
+    ramdisk_init (ramdisk_sectors);
+  if (stripe_bdev_names != NULL)
+    stripe_init (stripe_bdev_names);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -246,6 +257,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-stripe"))
+        stripe_bdev_names = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_sectors = atoi (value);
+      else if (!strcmp (name, "-cache"))
+        buffer_cache_size = atoi (value);
+      else if (!strcmp (name, "-ra"))
+        read_ahead_window = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -377,6 +396,10 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -stripe=BDEV,...   Stripe file system over the BDEVs (as "STRIPE_NAME").\n"
+          "  -ramdisk=SECTORS   Add a RAM disk \"ram0\" of SECTORS sectors.\n"
+          "  -cache=SECTORS     Cache SECTORS disk sectors instead of a share of RAM.\n"
+          "  -ra=SECTORS        Read SECTORS ahead of sequential readers.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -395,6 +418,8 @@ usage (void)
 static void
 locate_block_devices (void)
 {
+  if (stripe_bdev_names != NULL && filesys_bdev_name == NULL)
+    filesys_bdev_name = STRIPE_NAME;
   locate_block_device (BLOCK_FILESYS, filesys_bdev_name);
   locate_block_device (BLOCK_SCRATCH, scratch_bdev_name);
 #ifdef VM
@@ -3,6 +3,7 @@
 #include "filesys/file.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "lib/stdbool.h"
 #include <stdio.h>
 #include <syscall-nr.h>
@@ -17,6 +18,7 @@
 #include "process.h"
 #include "threads/synch.h"
 #include <string.h>
+#include <hash.h>
 #include "filesys/off_t.h"
 typedef int pid_t;
 static void syscall_handler (struct intr_frame *);
@@ -48,8 +50,9 @@ bool mkdir(char *);
 bool readdir(int, char *);
 bool isdir(int x);
 int inumber(int x);
+bool cache_stat(struct cache_stat *);
 struct inode{
-	struct list_elem elem;
+	struct hash_elem elem;
 	block_sector_t sector;
 
 	int open_cnt;
@@ -169,6 +172,10 @@ syscall_handler (struct intr_frame *f)
 			check_addr(esp32_ptr,1);
 			f->eax=inumber((int)esp32_ptr[1]);
 			break;
+		case SYS_CACHE_STAT:
+			check_addr(esp32_ptr,1);
+			f->eax=cache_stat((struct cache_stat *)esp32_ptr[1]);
+			break;
 
 
 	}
@@ -413,3 +420,17 @@ int inumber(int x){
 		exit(-1);
 	return inode_get_inumber(file_get_inode(thread_current()->desc[x]));
 }
+
+bool cache_stat(struct cache_stat *st){
+	struct cache_stat tmp;
+	char *last=(char *)st+sizeof *st-1;
+	//both ends in user space and mapped, so the copy stays in this process
+	if(!st||!is_user_vaddr(st)||!is_user_vaddr(last))
+		exit(-1);
+	if(!pagedir_get_page(thread_current()->pagedir,st)||!pagedir_get_page(thread_current()->pagedir,last))
+		exit(-1);
+	//copy out after dropping the cache lock
+	buffer_cache_get_stat(&tmp);
+	memcpy(st,&tmp,sizeof tmp);
+	return true;
+}